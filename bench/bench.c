@@ -0,0 +1,369 @@
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "slab.h"
+#include "rip.h"
+#include "packet.h"
+#include "cache.h"
+#include "metrics.h"
+
+#define BENCHTIME 200000000ULL
+#define MAXITERATIONS (1ULL << 30)
+#define TRACKSECONDS 180
+#define FANOUTCLIENTS 256
+#define CLIENTSIZE 64
+
+struct bench {
+    const char *name;
+    uint64_t iterations;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t allocs;
+};
+
+static uint64_t allocs;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+static void bench_reset(struct bench *b) {
+    b->allocs = __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+    b->start = metrics_now();
+}
+
+static void bench_stop(struct bench *b) {
+    b->elapsed = metrics_now() - b->start;
+    b->allocs = __atomic_load_n(&allocs, __ATOMIC_RELAXED) - b->allocs;
+}
+
+static int bench_run(const char *name, int (*fn)(struct bench *, void *),
+                     void *arg)
+{
+    struct bench b;
+    uint64_t n = 1;
+
+    memset(&b, 0, sizeof b);
+    b.name = name;
+
+    while (1) {
+        b.iterations = n;
+        if (fn(&b, arg) == -1) {
+            fprintf(stderr, "%s: failed\n", name);
+            return -1;
+        }
+
+        if (b.elapsed >= BENCHTIME || n >= MAXITERATIONS) break;
+
+        if (b.elapsed == 0) n *= 100;
+        else if (BENCHTIME / b.elapsed > 100) n *= 100;
+        else n = n * BENCHTIME / b.elapsed * 6 / 5 + 1;
+    }
+
+    printf("%s\t%llu\t%.2f ns/op\t%.2f allocs/op\n", name,
+           (unsigned long long) b.iterations,
+           (double) b.elapsed / b.iterations,
+           (double) b.allocs / b.iterations);
+
+    return 0;
+}
+
+static int bench_slab_churn(struct bench *b, void *arg) {
+    size_t entries = *(size_t *) arg, *keys, i, j;
+    char element[CLIENTSIZE] = {0};
+    uint64_t k;
+    slab_t slab;
+
+    if (slab_new(&slab, entries, sizeof element) == -1) return -1;
+
+    keys = (size_t *) malloc(entries * sizeof(size_t));
+    if (keys == NULL) return -1;
+
+    for (i = 0; i < entries; i++)
+        keys[i] = slab_insert(&slab, element);
+
+    bench_reset(b);
+
+    for (k = 0, j = 0; k < b->iterations; k++) {
+        j = (j * 1103515245 + 12345) % entries;
+        slab_remove(&slab, keys[j]);
+        keys[j] = slab_insert(&slab, element);
+    }
+
+    bench_stop(b);
+
+    free(keys);
+    slab_free(&slab);
+    return 0;
+}
+
+static int bench_slab_iter(struct bench *b, void *arg) {
+    size_t entries = *(size_t *) arg, i, sum = 0;
+    char element[CLIENTSIZE] = {0};
+    slab_iter_t iter;
+    uint64_t k;
+    slab_t slab;
+
+    if (slab_new(&slab, entries, sizeof element) == -1) return -1;
+
+    for (i = 0; i < entries; i++)
+        slab_insert(&slab, element);
+
+    bench_reset(b);
+
+    for (k = 0; k < b->iterations;) {
+        for (slab_iter_create(&slab, &iter);
+             !slab_iter_done(&iter) && k < b->iterations;
+             slab_iter_next(&slab, &iter), k++)
+            sum += *(char *) iter.data;
+    }
+
+    bench_stop(b);
+    __asm__ volatile("" : : "r"(sum));
+
+    slab_free(&slab);
+    return 0;
+}
+
+static size_t make_track(char *out, size_t data_len) {
+    static const char *const STRINGS[] = {"Song", "Artist", "Album"};
+    size_t len = 3, i;
+
+    memcpy(out, "rip", 3);
+
+    for (i = 0; i < 3; i++) {
+        out[len++] = strlen(STRINGS[i]) >> 8;
+        out[len++] = strlen(STRINGS[i]);
+        memcpy(out + len, STRINGS[i], strlen(STRINGS[i]));
+        len += strlen(STRINGS[i]);
+    }
+
+    out[len++] = data_len >> 24;
+    out[len++] = data_len >> 16;
+    out[len++] = data_len >> 8;
+    out[len++] = data_len;
+    memset(out + len, 0x55, data_len);
+
+    return len + data_len;
+}
+
+static int bench_parse(struct bench *b, void *arg __attribute__((unused))) {
+    struct rip_metadata metadata;
+    char buf[64 + BYTERATE];
+    size_t len = make_track(buf, BYTERATE);
+    uint64_t k;
+
+    bench_reset(b);
+
+    for (k = 0; k < b->iterations; k++) {
+        if (rip_parse_metadata(buf, len, &metadata) == -1) return -1;
+        __asm__ volatile("" : : "r"(&metadata) : "memory");
+    }
+
+    bench_stop(b);
+    return 0;
+}
+
+static int bench_encode(struct bench *b, void *arg __attribute__((unused))) {
+    struct rip_metadata metadata;
+    char buf[64 + BYTERATE], out[256];
+    size_t len = make_track(buf, BYTERATE);
+    uint64_t k;
+
+    if (rip_parse_metadata(buf, len, &metadata) == -1) return -1;
+
+    bench_reset(b);
+
+    for (k = 0; k < b->iterations; k++) {
+        rip_encode_metadata(&metadata, out);
+        __asm__ volatile("" : : "r"(out) : "memory");
+    }
+
+    bench_stop(b);
+    return 0;
+}
+
+static struct rip_map *map_track(size_t data_len) {
+    char path[] = "/tmp/rip-bench-XXXXXX";
+    struct rip_map *map;
+    char *buf;
+    size_t len;
+    int fd;
+
+    buf = (char *) malloc(64 + data_len);
+    if (buf == NULL) return NULL;
+    len = make_track(buf, data_len);
+
+    fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        free(buf);
+        return NULL;
+    }
+
+    if (write(fd, buf, len) != (ssize_t) len) {
+        perror("write");
+        map = NULL;
+    } else {
+        map = rip_map_open(path);
+    }
+
+    close(fd);
+    unlink(path);
+    free(buf);
+
+    return map;
+}
+
+static struct packet *metadata_packet(const struct rip_metadata *metadata) {
+    struct packet *packet;
+
+    packet = packet_new(rip_metadata_size(metadata));
+    if (packet == NULL) return NULL;
+
+    rip_encode_metadata(metadata, packet->data);
+    return packet;
+}
+
+static int bench_frame(struct bench *b, void *arg) {
+    struct rip_map *map = (struct rip_map *) arg;
+    struct cache_entry *entry;
+    struct packet *metadata;
+    struct cache cache;
+    uint64_t k, frames = 0;
+
+    if (cache_new(&cache, 0, 250) == -1) return -1;
+
+    metadata = metadata_packet(&map->metadata);
+    if (metadata == NULL) return -1;
+
+    bench_reset(b);
+
+    for (k = 0; k < b->iterations;) {
+        entry = cache_insert(&cache, "bench", rip_map_ref(map),
+                             packet_ref(metadata));
+        if (entry == NULL) return -1;
+
+        frames = entry->frames_len;
+        k += frames;
+        cache_release(&cache, entry);
+    }
+
+    bench_stop(b);
+    b->iterations = k;
+
+    packet_unref(metadata);
+    cache_free(&cache);
+    return frames == 0 ? -1 : 0;
+}
+
+static int bench_fanout(struct bench *b, void *arg) {
+    struct rip_map *map = (struct rip_map *) arg;
+    struct cache_entry *entry;
+    struct packet *metadata, *frame;
+    struct iovec iov[2];
+    struct cache cache;
+    int fds[FANOUTCLIENTS][2], i, n, status = 0;
+    char sink[4096];
+    uint64_t k;
+
+    if (cache_new(&cache, 0, 250) == -1) return -1;
+
+    metadata = metadata_packet(&map->metadata);
+    if (metadata == NULL) return -1;
+
+    entry = cache_insert(&cache, "bench", rip_map_ref(map), metadata);
+    if (entry == NULL) return -1;
+    frame = entry->frames[0];
+
+    for (i = 0; i < FANOUTCLIENTS; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds[i])
+            == -1)
+        {
+            perror("socketpair");
+            return -1;
+        }
+    }
+
+    n = packet_iov(frame, 0, iov);
+
+    bench_reset(b);
+
+    for (k = 0; k < b->iterations && status == 0;) {
+        for (i = 0; i < FANOUTCLIENTS && k < b->iterations; i++, k++) {
+            if (writev(fds[i][0], iov, n) != (ssize_t) frame->len) {
+                perror("writev");
+                status = -1;
+                break;
+            }
+        }
+
+        for (i = 0; i < FANOUTCLIENTS; i++)
+            while (read(fds[i][1], sink, sizeof sink) > 0);
+    }
+
+    bench_stop(b);
+
+    for (i = 0; i < FANOUTCLIENTS; i++) {
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+
+    cache_release(&cache, entry);
+    cache_free(&cache);
+    return status;
+}
+
+int main(void) {
+    static size_t SIZES[] = {64, 10000, 100000};
+    static const char *const CHURN[] = {
+        "slab_churn/64", "slab_churn/10k", "slab_churn/100k"
+    };
+    static const char *const ITER[] = {
+        "slab_iter/64", "slab_iter/10k", "slab_iter/100k"
+    };
+    struct rip_map *map;
+    int i, status = 0;
+
+    for (i = 0; i < 3; i++) {
+        status |= bench_run(CHURN[i], bench_slab_churn, &SIZES[i]);
+        status |= bench_run(ITER[i], bench_slab_iter, &SIZES[i]);
+    }
+
+    status |= bench_run("rip_parse_metadata", bench_parse, NULL);
+    status |= bench_run("rip_encode_metadata", bench_encode, NULL);
+
+    map = map_track((size_t) TRACKSECONDS * BYTERATE);
+    if (map == NULL) return EXIT_FAILURE;
+
+    status |= bench_run("track_frame", bench_frame, map);
+    status |= bench_run("fanout_socketpair", bench_fanout, map);
+
+    rip_map_unref(map);
+
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
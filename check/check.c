@@ -0,0 +1,514 @@
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "rip.h"
+#include "log.h"
+#include "packet.h"
+#include "cache.h"
+#include "ripx.h"
+#include "track.h"
+#include "loader.h"
+#include "station.h"
+#include "relay.h"
+
+#define CHECKINTERVAL 100
+#define CHECKTICK (CHECKINTERVAL * BYTERATE / 1000)
+#define CHECKTICKS 400
+
+static uint32_t read_u32(const char *buf) {
+    const unsigned char *p = (const unsigned char *) buf;
+
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16
+        | (uint32_t) p[2] << 8 | p[3];
+}
+
+static void write_u32(char *buf, uint32_t value) {
+    buf[0] = value >> 24;
+    buf[1] = value >> 16;
+    buf[2] = value >> 8;
+    buf[3] = value;
+}
+
+static int write_track(const char *dir, const char *file, const char *name,
+                       size_t data_len)
+{
+    char path[256], *buf;
+    size_t len = 0, name_len = strlen(name);
+    FILE *out;
+    int status = 0;
+
+    buf = (char *) malloc(32 + name_len + data_len);
+    if (buf == NULL) return -1;
+
+    memcpy(buf, "rip", 3);
+    len = 3;
+    buf[len++] = name_len >> 8;
+    buf[len++] = name_len;
+    memcpy(buf + len, name, name_len);
+    len += name_len;
+    memcpy(buf + len, "\0\5check\0\5check", 14);
+    len += 14;
+    buf[len++] = data_len >> 24;
+    buf[len++] = data_len >> 16;
+    buf[len++] = data_len >> 8;
+    buf[len++] = data_len;
+    memset(buf + len, 0x55, data_len);
+    len += data_len;
+
+    snprintf(path, sizeof path, "%s/%s", dir, file);
+    out = fopen(path, "wb");
+    if (out == NULL || fwrite(buf, 1, len, out) != len) {
+        perror(path);
+        status = -1;
+    }
+
+    if (out != NULL) fclose(out);
+    free(buf);
+    return status;
+}
+
+static int remove_entry(const char *path,
+                        const struct stat *st __attribute__((unused)),
+                        int flag __attribute__((unused)),
+                        struct FTW *ftw __attribute__((unused)))
+{
+    return remove(path);
+}
+
+static void remove_dir(const char *dir) {
+    nftw(dir, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+}
+
+static void wait_prefetch(struct station *station) {
+    size_t head, tail;
+
+    while (1) {
+        head = __atomic_load_n(&station->ready.head, __ATOMIC_ACQUIRE);
+        tail = __atomic_load_n(&station->ready.tail, __ATOMIC_RELAXED);
+        if (head - tail >= (size_t) station->prefetching) return;
+
+        nanosleep(&(struct timespec){0, 1000000}, NULL);
+    }
+}
+
+static int in_frames(const struct cache_entry *entry,
+                     const struct packet *packet)
+{
+    size_t i;
+
+    for (i = 0; i < entry->frames_len; i++)
+        if (entry->frames[i] == packet) return 1;
+
+    return 0;
+}
+
+static int check_stitch(void) {
+    static const size_t SIZES[] = {
+        5 * CHECKTICK + 8, 1234, 3 * CHECKTICK + CHECKTICK - 1
+    };
+    char dir[] = "/tmp/rip-check-XXXXXX", file[32], name[32];
+    struct packet *packets[MAXTICKPACKETS];
+    const struct cache_entry *entry;
+    struct station station;
+    struct loader loader;
+    struct cache cache;
+    uint64_t bytes = 0, transitions = 0, tick;
+    uint32_t len, time, last = 0;
+    int i, n, fresh = 1, status = 0;
+
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return -1;
+    }
+
+    for (i = 0; i < 3; i++) {
+        snprintf(file, sizeof file, "track%d.rip", i);
+        snprintf(name, sizeof name, "Track %d", i);
+        if (write_track(dir, file, name, SIZES[i]) == -1) status = -1;
+    }
+
+    if (status == 0) status = cache_new(&cache, 1 << 20, CHECKINTERVAL);
+    if (status == 0) status = loader_new(&loader, &cache);
+    if (status == 0) status = station_new(&station, 0, dir, &loader);
+    if (status == -1) {
+        remove_dir(dir);
+        return -1;
+    }
+
+    for (tick = 0; tick < CHECKTICKS && status == 0; tick++) {
+        wait_prefetch(&station);
+
+        entry = station.track->entry;
+        n = station_tick(&station, packets, MAXTICKPACKETS);
+
+        for (i = 0; i < n; i++) {
+            if (packets[i]->data[0] == 1) {
+                entry = station.track->entry;
+                fresh = 1;
+                transitions++;
+                continue;
+            }
+
+            len = read_u32(packets[i]->data + 1);
+            time = read_u32(packets[i]->data + 5);
+            bytes += len;
+
+            if (fresh ? time != 0 : time <= last) {
+                fprintf(stderr, "stitch: tick %llu time %u after %u\n",
+                        (unsigned long long) tick, time, last);
+                status = -1;
+            }
+
+            if (!in_frames(entry, packets[i])) {
+                fprintf(stderr, "stitch: tick %llu frame not cached\n",
+                        (unsigned long long) tick);
+                status = -1;
+            }
+
+            last = time;
+            fresh = 0;
+        }
+
+        for (i = 0; i < n; i++)
+            packet_unref(packets[i]);
+    }
+
+    if (status == 0 && bytes != tick * CHECKTICK + station.debt) {
+        fprintf(stderr, "stitch: sent %llu bytes in %llu ticks, debt %zu\n",
+                (unsigned long long) bytes, (unsigned long long) tick,
+                station.debt);
+        status = -1;
+    }
+
+    if (status == 0 && (transitions < 10 || station.debt >= 2 * CHECKTICK)) {
+        fprintf(stderr, "stitch: %llu transitions, debt %zu\n",
+                (unsigned long long) transitions, station.debt);
+        status = -1;
+    }
+
+    loader_free(&loader);
+    station_free(&station);
+    cache_free(&cache);
+    remove_dir(dir);
+
+    return status;
+}
+
+static int check_remove(void) {
+    char dir[] = "/tmp/rip-check-XXXXXX", file[32], name[32];
+    struct packet *packets[MAXTICKPACKETS];
+    struct station station;
+    struct loader loader;
+    struct cache cache;
+    uint64_t tick, transitions = 0;
+    int i, n, status = 0;
+
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return -1;
+    }
+
+    for (i = 0; i < 4; i++) {
+        snprintf(file, sizeof file, "track%d.rip", i);
+        snprintf(name, sizeof name, "Track %d", i);
+        if (write_track(dir, file, name, 2 * CHECKTICK) == -1) status = -1;
+    }
+
+    if (status == 0) status = cache_new(&cache, 1 << 20, CHECKINTERVAL);
+    if (status == 0) status = loader_new(&loader, &cache);
+    if (status == 0) status = station_new(&station, 0, dir, &loader);
+    if (status == -1) {
+        remove_dir(dir);
+        return -1;
+    }
+
+    wait_prefetch(&station);
+    if (station.prefetch_song != PREFETCH
+        || station_remove(&station, "track2.rip") == -1)
+        status = -1;
+
+    for (tick = 0; tick < 40 && status == 0; tick++) {
+        wait_prefetch(&station);
+        n = station_tick(&station, packets, MAXTICKPACKETS);
+
+        for (i = 0; i < n; i++) {
+            if (packets[i]->data[0] != 1) continue;
+
+            transitions++;
+            if (strstr(station.track->path, "track2") != NULL
+                || strcmp(station.playlist[station.current_song],
+                          station.track->path) != 0)
+            {
+                fprintf(stderr, "remove: playing %s as song %d\n",
+                        station.track->path, station.current_song);
+                status = -1;
+            }
+        }
+
+        for (i = 0; i < n; i++)
+            packet_unref(packets[i]);
+    }
+
+    if (status == 0 && transitions < 10) {
+        fprintf(stderr, "remove: %llu transitions\n",
+                (unsigned long long) transitions);
+        status = -1;
+    }
+
+    loader_free(&loader);
+    station_free(&station);
+    cache_free(&cache);
+    remove_dir(dir);
+
+    return status;
+}
+
+static int check_rewrite(void) {
+    char dir[] = "/tmp/rip-check-XXXXXX", path[64];
+    struct track *first = NULL, *second = NULL;
+    struct cache cache;
+    int status = 0;
+
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return -1;
+    }
+
+    snprintf(path, sizeof path, "%s/track.rip", dir);
+
+    if (cache_new(&cache, 1 << 20, CHECKINTERVAL) == -1) {
+        remove_dir(dir);
+        return -1;
+    }
+
+    first = track_new(path);
+    second = track_new(path);
+    if (first == NULL || second == NULL
+        || write_track(dir, "track.rip", "Before", 3 * CHECKTICK) == -1
+        || track_load(first, &cache) == -1
+        || write_track(dir, "track.rip", "After", CHECKTICK) == -1
+        || track_load(second, &cache) == -1)
+    {
+        status = -1;
+    }
+
+    if (status == 0 && (first->entry == second->entry
+                        || second->map->metadata.size != CHECKTICK
+                        || !track_stale(first) || track_stale(second)))
+    {
+        fprintf(stderr, "rewrite: stale cache entry served\n");
+        status = -1;
+    }
+
+    track_free(first);
+    if (status == 0 && cache.used != second->entry->cost) {
+        fprintf(stderr, "rewrite: stale entry kept, %zu bytes cached\n",
+                cache.used);
+        status = -1;
+    }
+
+    track_free(second);
+    cache_free(&cache);
+    remove_dir(dir);
+
+    return status;
+}
+
+static int write_archive(const char *path, uint64_t data_offset) {
+    static char buf[2 * RIPXALIGN];
+    struct rip_metadata metadata;
+    struct ripx_entry entry;
+    FILE *out;
+    int status = 0;
+
+    memset(buf, 0, sizeof buf);
+    memset(&metadata, 0, sizeof metadata);
+    metadata.name.data = metadata.artist.data = metadata.album.data = "x";
+    metadata.name.len = metadata.artist.len = metadata.album.len = 1;
+    metadata.length = BYTES_TO_CS(RIPXALIGN);
+
+    entry.metadata_offset = RIPXHEADERSIZE + RIPXENTRYSIZE;
+    entry.metadata_len = rip_encode_metadata(&metadata,
+                                             buf + entry.metadata_offset);
+    entry.data_offset = data_offset;
+    entry.data_len = RIPXALIGN;
+
+    ripx_encode_header(buf, 1);
+    ripx_encode_entry(buf + RIPXHEADERSIZE, &entry);
+
+    out = fopen(path, "wb");
+    if (out == NULL || fwrite(buf, 1, sizeof buf, out) != sizeof buf) {
+        perror(path);
+        status = -1;
+    }
+
+    if (out != NULL) fclose(out);
+    return status;
+}
+
+static int check_archive(void) {
+    char dir[] = "/tmp/rip-check-XXXXXX", path[64];
+    struct ripx ripx;
+    int status = 0;
+
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return -1;
+    }
+
+    snprintf(path, sizeof path, "%s/check.ripx", dir);
+    memset(&ripx, 0, sizeof ripx);
+
+    if (write_archive(path, RIPXALIGN) == -1
+        || ripx_open(&ripx, path) == -1)
+    {
+        fprintf(stderr, "archive: valid archive rejected\n");
+        status = -1;
+    }
+    ripx_free(&ripx);
+
+    if (status == 0 && (write_archive(path, -(uint64_t) RIPXALIGN) == -1
+                        || ripx_open(&ripx, path) == 0))
+    {
+        fprintf(stderr, "archive: wrapping data offset accepted\n");
+        status = -1;
+    }
+    ripx_free(&ripx);
+
+    remove_dir(dir);
+    return status;
+}
+
+static size_t relay_packet(char *buf, int type, uint32_t value) {
+    static const char metadata[] = {0, 1, 'x', 0, 1, 'x', 0, 1, 'x'};
+    size_t len;
+
+    buf[0] = type;
+    write_u32(buf + 1, type == 1 ? value : 4);
+
+    if (type == 1) {
+        memcpy(buf + 5, metadata, sizeof metadata);
+        len = 5 + sizeof metadata;
+    } else {
+        write_u32(buf + 5, value);
+        memset(buf + HEADERSIZE, 0x55, 4);
+        len = HEADERSIZE + 4;
+    }
+
+    return len;
+}
+
+static int relay_feed(struct relay *relay, const uint32_t (*script)[2],
+                      int script_len, char *out, size_t out_cap)
+{
+    struct packet *packet;
+    char buf[64];
+    size_t len, used = 0;
+    int sv[2], i, status;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == -1) {
+        perror("socketpair");
+        return -1;
+    }
+    relay->handle.fd = sv[0];
+
+    for (i = 0; i < script_len; i++) {
+        len = relay_packet(buf, script[i][0], script[i][1]);
+        if (write(sv[1], buf, len) != (ssize_t) len) return -1;
+    }
+    close(sv[1]);
+
+    while (relay_fill(relay) > 0) {
+        while ((status = relay_next(relay, &packet)) == 1) {
+            i = packet->data[0] == 1;
+            used += snprintf(out + used, out_cap - used, "%c%u ",
+                             i ? 'm' : 'a',
+                             read_u32(packet->data + (i ? 1 : 5)));
+            packet_unref(packet);
+        }
+
+        if (status == -1) return -1;
+    }
+
+    relay_close(relay);
+    return 0;
+}
+
+static int check_reconnect(void) {
+    static const uint32_t first[][2] = {
+        {1, 300}, {2, 0}, {2, 10}, {2, 20}
+    };
+    static const uint32_t same[][2] = {
+        {1, 300}, {2, 0}, {2, 10}, {2, 20}, {2, 30}
+    };
+    static const uint32_t next[][2] = {
+        {1, 400}, {2, 0}, {2, 10}
+    };
+    static const struct {
+        const uint32_t (*script)[2];
+        int len;
+        const char *expect;
+    } steps[] = {
+        {first, 4, "m300 a0 a10 a20 "},
+        {same, 5, "a30 "},
+        {next, 3, "m400 a0 a10 "}
+    };
+    struct sockaddr_storage addr;
+    struct relay relay;
+    char out[256];
+    int i, status = 0;
+
+    memset(&addr, 0, sizeof addr);
+    if (relay_new(&relay, 0, "check", (struct sockaddr *) &addr,
+                  sizeof addr, NULL) == -1)
+        return -1;
+
+    for (i = 0; i < 3 && status == 0; i++) {
+        out[0] = '\0';
+        if (relay_feed(&relay, steps[i].script, steps[i].len, out,
+                       sizeof out) == -1
+            || strcmp(out, steps[i].expect) != 0)
+        {
+            fprintf(stderr, "relay: connection %d forwarded \"%s\"\n",
+                    i + 1, out);
+            status = -1;
+        }
+    }
+
+    relay_free(&relay);
+    return status;
+}
+
+static int check_run(const char *name, int (*fn)(void)) {
+    int status = fn();
+
+    printf("%s\t%s\n", name, status == 0 ? "ok" : "FAIL");
+    return status;
+}
+
+int main(void) {
+    int status = 0;
+
+    if (log_start(LOG_ERROR) == -1) return EXIT_FAILURE;
+    log_attach("check");
+
+    status |= check_run("station_stitch", check_stitch);
+    status |= check_run("station_remove", check_remove);
+    status |= check_run("cache_rewrite", check_rewrite);
+    status |= check_run("ripx_bounds", check_archive);
+    status |= check_run("relay_reconnect", check_reconnect);
+
+    log_stop();
+
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
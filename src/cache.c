@@ -0,0 +1,232 @@
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rip.h"
+#include "packet.h"
+#include "cache.h"
+
+static size_t hash(const char *key) {
+    size_t h = 5381;
+
+    while (*key) h = h * 33 + (unsigned char) *key++;
+
+    return h % CACHEBUCKETS;
+}
+
+static void release_map(void *owner) {
+    rip_map_unref((struct rip_map *) owner);
+}
+
+static void lru_unlink(struct cache *cache, struct cache_entry *entry) {
+    if (entry->newer != NULL) entry->newer->older = entry->older;
+    else cache->newest = entry->older;
+
+    if (entry->older != NULL) entry->older->newer = entry->newer;
+    else cache->oldest = entry->newer;
+
+    entry->newer = entry->older = NULL;
+}
+
+static void lru_push(struct cache *cache, struct cache_entry *entry) {
+    entry->older = cache->newest;
+    entry->newer = NULL;
+
+    if (cache->newest != NULL) cache->newest->newer = entry;
+    else cache->oldest = entry;
+
+    cache->newest = entry;
+}
+
+static void entry_free(struct cache_entry *entry) {
+    size_t i;
+
+    for (i = 0; i < entry->frames_len; i++)
+        packet_unref(entry->frames[i]);
+
+    free(entry->frames);
+    packet_unref(entry->metadata);
+    rip_map_unref(entry->map);
+    free(entry->key);
+    free(entry);
+}
+
+static void cache_remove(struct cache *cache, struct cache_entry *entry) {
+    struct cache_entry **link = &cache->buckets[hash(entry->key)];
+
+    while (*link != entry) link = &(*link)->next;
+    *link = entry->next;
+
+    lru_unlink(cache, entry);
+    cache->used -= entry->cost;
+    entry_free(entry);
+}
+
+static void cache_evict(struct cache *cache) {
+    struct cache_entry *entry, *newer;
+
+    for (entry = cache->oldest; entry != NULL; entry = newer) {
+        newer = entry->newer;
+        if (entry->users != 0) continue;
+
+        if (entry->stale) {
+            cache_remove(cache, entry);
+        } else if (cache->used > cache->budget) {
+            cache_remove(cache, entry);
+            cache->evictions++;
+        }
+    }
+}
+
+static int entry_frame(struct cache *cache, struct cache_entry *entry) {
+    const struct rip_metadata *metadata = &entry->map->metadata;
+    uint64_t start, end;
+    struct packet *packet;
+    size_t i;
+
+    entry->frames_len = ((uint64_t) metadata->size * 1000
+        + (uint64_t) cache->interval * BYTERATE - 1)
+        / ((uint64_t) cache->interval * BYTERATE);
+
+    entry->frames = (struct packet **) calloc(entry->frames_len,
+                                              sizeof(struct packet *));
+    if (entry->frames == NULL && entry->frames_len != 0) {
+        perror("calloc");
+        entry->frames_len = 0;
+        return -1;
+    }
+
+    for (i = 0; i < entry->frames_len; i++) {
+        start = (uint64_t) i * cache->interval * BYTERATE / 1000;
+        end = (uint64_t) (i + 1) * cache->interval * BYTERATE / 1000;
+        if (end > metadata->size) end = metadata->size;
+
+        packet = packet_new_view(HEADERSIZE, metadata->data + start,
+                                 end - start, release_map,
+                                 rip_map_ref(entry->map));
+        if (packet == NULL) {
+            rip_map_unref(entry->map);
+            return -1;
+        }
+
+        rip_encode_header(packet->data, end - start, start);
+        entry->frames[i] = packet;
+    }
+
+    entry->cost = metadata->size + entry->metadata->len
+        + entry->frames_len * (sizeof(struct packet) + HEADERSIZE);
+
+    return 0;
+}
+
+int cache_new(struct cache *cache, size_t budget, unsigned int interval) {
+    memset(cache, 0, sizeof(struct cache));
+    pthread_mutex_init(&cache->lock, NULL);
+
+    cache->budget = budget;
+    cache->interval = interval;
+
+    return 0;
+}
+
+void cache_free(struct cache *cache) {
+    struct cache_entry *entry, *older;
+
+    for (entry = cache->newest; entry != NULL; entry = older) {
+        older = entry->older;
+        entry_free(entry);
+    }
+
+    pthread_mutex_destroy(&cache->lock);
+}
+
+struct cache_entry *cache_lookup(struct cache *cache, const char *key) {
+    struct cache_entry *entry;
+
+    pthread_mutex_lock(&cache->lock);
+
+    for (entry = cache->buckets[hash(key)]; entry != NULL;
+         entry = entry->next)
+        if (!entry->stale && strcmp(entry->key, key) == 0) break;
+
+    if (entry != NULL) {
+        entry->users++;
+        lru_unlink(cache, entry);
+        lru_push(cache, entry);
+        cache->hits++;
+    } else {
+        cache->misses++;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return entry;
+}
+
+struct cache_entry *cache_insert(struct cache *cache, const char *key,
+                                 struct rip_map *map,
+                                 struct packet *metadata)
+{
+    struct cache_entry *entry;
+    size_t bucket = hash(key);
+
+    entry = (struct cache_entry *) calloc(1, sizeof(struct cache_entry));
+    if (entry == NULL) {
+        perror("calloc");
+        rip_map_unref(map);
+        packet_unref(metadata);
+        return NULL;
+    }
+
+    entry->map = map;
+    entry->metadata = metadata;
+    entry->users = 1;
+
+    entry->key = strdup(key);
+    if (entry->key == NULL || entry_frame(cache, entry) == -1) {
+        entry_free(entry);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+
+    entry->next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    lru_push(cache, entry);
+    cache->used += entry->cost;
+
+    cache_evict(cache);
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return entry;
+}
+
+void cache_invalidate(struct cache *cache, const char *key) {
+    struct cache_entry *entry;
+
+    pthread_mutex_lock(&cache->lock);
+
+    for (entry = cache->buckets[hash(key)]; entry != NULL;
+         entry = entry->next)
+        if (strcmp(entry->key, key) == 0) entry->stale = 1;
+
+    cache_evict(cache);
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void cache_release(struct cache *cache, struct cache_entry *entry) {
+    if (entry == NULL) return;
+
+    pthread_mutex_lock(&cache->lock);
+
+    entry->users--;
+    cache_evict(cache);
+
+    pthread_mutex_unlock(&cache->lock);
+}
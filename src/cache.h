@@ -0,0 +1,53 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "rip.h"
+#include "packet.h"
+
+#define CACHEBUCKETS 1024
+#define CACHEBUDGET 256
+
+struct cache_entry {
+    char *key;
+    size_t users;
+    size_t cost;
+    unsigned int stale: 1;
+
+    struct rip_map *map;
+    struct packet *metadata;
+    struct packet **frames;
+    size_t frames_len;
+
+    struct cache_entry *next;
+    struct cache_entry *newer;
+    struct cache_entry *older;
+};
+
+struct cache {
+    pthread_mutex_t lock;
+    unsigned int interval;
+    size_t budget;
+    size_t used;
+
+    struct cache_entry *buckets[CACHEBUCKETS];
+    struct cache_entry *newest;
+    struct cache_entry *oldest;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+int cache_new(struct cache *cache, size_t budget, unsigned int interval);
+void cache_free(struct cache *cache);
+struct cache_entry *cache_lookup(struct cache *cache, const char *key);
+struct cache_entry *cache_insert(struct cache *cache, const char *key,
+                                 struct rip_map *map,
+                                 struct packet *metadata);
+void cache_release(struct cache *cache, struct cache_entry *entry);
+void cache_invalidate(struct cache *cache, const char *key);
+
+#endif
@@ -0,0 +1,107 @@
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "handoff.h"
+
+int handoff_send(int sock, enum handoff_type type, const void *data,
+                 size_t len, int fd)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    uint32_t header = type;
+    struct cmsghdr *cmsg;
+    struct iovec iov[2];
+    struct msghdr msg;
+    ssize_t count;
+
+    memset(&msg, 0, sizeof msg);
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof header;
+    iov[1].iov_base = (void *) data;
+    iov[1].iov_len = len;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    if (fd != -1) {
+        memset(control, 0, sizeof control);
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof fd);
+    }
+
+    do {
+        count = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (count == -1 && errno == EINTR);
+
+    if (count == -1) {
+        perror("handoff: sendmsg");
+        return -1;
+    }
+
+    return 0;
+}
+
+ssize_t handoff_recv(int sock, enum handoff_type type, void *data,
+                     size_t len, int *fd)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr *cmsg;
+    struct iovec iov[2];
+    struct msghdr msg;
+    uint32_t header;
+    ssize_t count;
+    int received = -1;
+
+    memset(&msg, 0, sizeof msg);
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof header;
+    iov[1].iov_base = data;
+    iov[1].iov_len = len;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+
+    do {
+        count = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (count == -1 && errno == EINTR);
+
+    if (count == -1) {
+        perror("handoff: recvmsg");
+        return -1;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(&received, CMSG_DATA(cmsg), sizeof received);
+    }
+
+    if (count < (ssize_t) sizeof header || header != (uint32_t) type
+        || msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+    {
+        if (count == 0) fprintf(stderr, "handoff: peer closed\n");
+        else fprintf(stderr, "handoff: unexpected message\n");
+        if (received != -1) close(received);
+        return -1;
+    }
+
+    if (fd != NULL) *fd = received;
+    else if (received != -1) close(received);
+
+    return count - sizeof header;
+}
@@ -0,0 +1,54 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define HANDOFFENV "RIP_STREAM_HANDOFF"
+#define HANDOFFCHUNK 65536
+#define HELLOSIZE 257
+
+enum handoff_type {
+    HANDOFF_READY,
+    HANDOFF_SERVER,
+    HANDOFF_STATION,
+    HANDOFF_LISTENER,
+    HANDOFF_CLIENT,
+    HANDOFF_BACKLOG,
+    HANDOFF_DONE
+};
+
+struct handoff_server {
+    uint32_t shards;
+    uint32_t stations;
+    uint64_t tick;
+};
+
+struct handoff_station {
+    int32_t song;
+    uint64_t offset;
+    uint64_t debt;
+};
+
+struct handoff_listener {
+    uint32_t clients;
+};
+
+struct handoff_client {
+    int32_t feed;
+    uint32_t initialized;
+    uint32_t zerocopy;
+    uint32_t zerocopy_next;
+    uint32_t zerocopy_done;
+    uint64_t backlog;
+    uint32_t hello_len;
+    char hello[HELLOSIZE];
+};
+
+int handoff_send(int sock, enum handoff_type type, const void *data,
+                 size_t len, int fd);
+ssize_t handoff_recv(int sock, enum handoff_type type, void *data,
+                     size_t len, int *fd);
+
+#endif
@@ -0,0 +1,408 @@
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rip.h"
+#include "library.h"
+#include "log.h"
+
+struct buffer {
+    char *data;
+    size_t len;
+    size_t capacity;
+};
+
+static int buffer_reserve(struct buffer *buffer, size_t len) {
+    size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+    char *data;
+
+    while (capacity - buffer->len < len) capacity *= 2;
+    if (capacity == buffer->capacity) return 0;
+
+    data = (char *) realloc(buffer->data, capacity);
+    if (data == NULL) {
+        perror("realloc");
+        return -1;
+    }
+
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+static int buffer_append(struct buffer *buffer, const void *data, size_t len,
+                         uint32_t *offset)
+{
+    if (buffer_reserve(buffer, len) == -1) return -1;
+
+    if (offset != NULL) *offset = buffer->len;
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+    return 0;
+}
+
+static int append_string(struct buffer *strings, const char *data,
+                         size_t len, uint32_t *offset)
+{
+    if (buffer_append(strings, data, len, offset) == -1) return -1;
+    return buffer_append(strings, "", 1, NULL);
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static int list_tracks(const char *dir_path, char ***out) {
+    struct dirent *dir;
+    char **names = NULL, **grown, *dot;
+    int n = 0, capacity = 0;
+    DIR *d;
+
+    d = opendir(dir_path);
+    if (d == NULL) {
+        perror("opendir");
+        return -1;
+    }
+
+    while ((dir = readdir(d)) != NULL) {
+        if (dir->d_type != DT_REG && dir->d_type != DT_UNKNOWN) continue;
+        dot = strrchr(dir->d_name, '.');
+        if (!dot || strcmp(dot, ".rip")) continue;
+
+        if (n == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            grown = (char **) realloc(names, capacity * sizeof(char *));
+            if (grown == NULL) goto fail;
+            names = grown;
+        }
+
+        names[n] = strdup(dir->d_name);
+        if (names[n] == NULL) goto fail;
+        n++;
+    }
+
+    closedir(d);
+
+    qsort(names, n, sizeof(char *), compare_names);
+    *out = names;
+    return n;
+
+fail:
+    perror("list_tracks");
+    while (n--) free(names[n]);
+    free(names);
+    closedir(d);
+    return -1;
+}
+
+static int library_map(struct library *library, int dfd) {
+    struct library_header *header;
+    struct library_entry *entry;
+    struct stat st;
+    uint64_t strings_len;
+    uint32_t i;
+    int fd;
+
+    fd = openat(dfd, LIBRARYINDEX, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof *header) {
+        close(fd);
+        return -1;
+    }
+
+    library->len = st.st_size;
+    library->base = mmap(NULL, library->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (library->base == MAP_FAILED) {
+        library->base = NULL;
+        return -1;
+    }
+
+    library->mapped = 1;
+
+    header = (struct library_header *) library->base;
+    if (memcmp(header->magic, LIBRARYMAGIC, 8) != 0
+        || header->version != LIBRARYVERSION
+        || (library->len - sizeof *header) / sizeof *entry < header->count)
+        goto invalid;
+
+    strings_len = library->len - sizeof *header
+        - (size_t) header->count * sizeof *entry;
+    if (header->strings_len != strings_len) goto invalid;
+
+    library->entries = (struct library_entry *) (header + 1);
+    library->count = header->count;
+    library->strings = (const char *) (library->entries + header->count);
+
+    for (i = 0; i < library->count; i++) {
+        entry = &library->entries[i];
+
+        if (entry->path >= strings_len
+            || memchr(library->strings + entry->path, 0,
+                      strings_len - entry->path) == NULL)
+            goto invalid;
+
+        if (i > 0 && strcmp(library->strings + entry[-1].path,
+                            library->strings + entry->path) >= 0)
+            goto invalid;
+    }
+
+    return 0;
+
+invalid:
+    log_print(LOG_WARN, "library %s: ignoring invalid %s", library->dir_path,
+              LIBRARYINDEX);
+    munmap(library->base, library->len);
+    library->base = NULL;
+    library->mapped = 0;
+    library->entries = NULL;
+    library->count = 0;
+    return -1;
+}
+
+static int scan_track(int dfd, const char *name) {
+    struct rip_metadata metadata;
+    struct stat st;
+    size_t len;
+    void *base;
+    int fd, status;
+
+    fd = openat(dfd, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("open");
+        return -1;
+    }
+
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+
+    len = st.st_size;
+    base = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    status = rip_parse_metadata(base, len, &metadata);
+    munmap(base, len);
+
+    return status;
+}
+
+static int add_entry(struct buffer *entries, struct buffer *strings,
+                     const char *path, const struct stat *st)
+{
+    struct library_entry entry;
+
+    memset(&entry, 0, sizeof entry);
+    entry.mtime = (int64_t) st->st_mtim.tv_sec * 1000000000
+        + st->st_mtim.tv_nsec;
+    entry.size = st->st_size;
+
+    if (append_string(strings, path, strlen(path), &entry.path) == -1)
+        return -1;
+
+    return buffer_append(entries, &entry, sizeof entry, NULL);
+}
+
+static int library_write(struct library *library, int dfd, char *image,
+                         size_t len)
+{
+    const char *tmp = LIBRARYINDEX ".tmp";
+    size_t done = 0;
+    ssize_t count;
+    int fd;
+
+    fd = openat(dfd, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) goto fail;
+
+    while (done < len) {
+        count = write(fd, image + done, len - done);
+        if (count == -1) {
+            if (errno == EINTR) continue;
+            close(fd);
+            unlinkat(dfd, tmp, 0);
+            goto fail;
+        }
+        done += count;
+    }
+
+    if (close(fd) == -1 || renameat(dfd, tmp, dfd, LIBRARYINDEX) == -1) {
+        unlinkat(dfd, tmp, 0);
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    log_print(LOG_WARN, "library %s: cannot write %s: %s", library->dir_path,
+              LIBRARYINDEX, strerror(errno));
+    return -1;
+}
+
+static int library_scan(struct library *library, int dfd) {
+    struct buffer entries = {0}, strings = {0};
+    struct library_header header;
+    struct library_entry *old;
+    struct stat st;
+    char **names, *image;
+    size_t len;
+    uint32_t j = 0, reused = 0;
+    int64_t mtime;
+    int i, n, cmp, status, changed = 0;
+
+    n = list_tracks(library->dir_path, &names);
+    if (n == -1) return -1;
+
+    for (i = 0; i < n; i++) {
+        if (fstatat(dfd, names[i], &st, 0) == -1 || !S_ISREG(st.st_mode))
+            continue;
+
+        mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+
+        old = NULL;
+        while (j < library->count) {
+            cmp = strcmp(library->strings + library->entries[j].path,
+                         names[i]);
+            if (cmp > 0) break;
+            j++;
+            if (cmp == 0) {
+                old = &library->entries[j - 1];
+                break;
+            }
+            changed = 1;
+        }
+
+        if (old != NULL && old->mtime == mtime
+            && old->size == (uint64_t) st.st_size)
+        {
+            status = add_entry(&entries, &strings, names[i], &st);
+            if (status == -1) goto fail;
+
+            reused++;
+            continue;
+        }
+
+        changed = 1;
+
+        status = scan_track(dfd, names[i]);
+        if (status == -1) {
+            log_print(LOG_WARN, "library %s: skipping %s", library->dir_path,
+                      names[i]);
+            continue;
+        }
+
+        status = add_entry(&entries, &strings, names[i], &st);
+        if (status == -1) goto fail;
+    }
+
+    if (j < library->count) changed = 1;
+
+    for (i = 0; i < n; i++) free(names[i]);
+    free(names);
+    names = NULL;
+
+    if (!changed) {
+        free(entries.data);
+        free(strings.data);
+        return 0;
+    }
+
+    memcpy(header.magic, LIBRARYMAGIC, 8);
+    header.version = LIBRARYVERSION;
+    header.count = entries.len / sizeof(struct library_entry);
+    header.strings_len = strings.len;
+
+    len = sizeof header + entries.len + strings.len;
+    image = (char *) malloc(len);
+    if (image == NULL) {
+        perror("malloc");
+        goto fail;
+    }
+
+    memcpy(image, &header, sizeof header);
+    if (entries.len != 0)
+        memcpy(image + sizeof header, entries.data, entries.len);
+    if (strings.len != 0)
+        memcpy(image + sizeof header + entries.len, strings.data, strings.len);
+
+    free(entries.data);
+    free(strings.data);
+
+    library_write(library, dfd, image, len);
+
+    log_print(LOG_INFO, "library %s: indexed %u tracks (%u unchanged)",
+              library->dir_path, header.count, reused);
+
+    if (library->mapped)
+        munmap(library->base, library->len);
+
+    library->base = image;
+    library->len = len;
+    library->mapped = 0;
+    library->entries = (struct library_entry *) (image + sizeof header);
+    library->count = header.count;
+    library->strings = image + sizeof header + entries.len;
+
+    return 0;
+
+fail:
+    if (names != NULL) {
+        for (i = 0; i < n; i++) free(names[i]);
+        free(names);
+    }
+    free(entries.data);
+    free(strings.data);
+    return -1;
+}
+
+int library_open(struct library *library, const char *dir_path) {
+    int dfd, status;
+
+    memset(library, 0, sizeof(struct library));
+
+    library->dir_path = strdup(dir_path);
+    if (library->dir_path == NULL) return -1;
+
+    dfd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd == -1) {
+        perror("open");
+        return -1;
+    }
+
+    library_map(library, dfd);
+
+    status = library_scan(library, dfd);
+    close(dfd);
+
+    return status;
+}
+
+void library_free(struct library *library) {
+    if (library->mapped)
+        munmap(library->base, library->len);
+    else
+        free(library->base);
+
+    free(library->dir_path);
+}
+
+const char *library_string(const struct library *library, uint32_t offset) {
+    return library->strings + offset;
+}
@@ -0,0 +1,39 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LIBRARYINDEX ".rip-index"
+#define LIBRARYMAGIC "RIPINDEX"
+#define LIBRARYVERSION 2
+
+struct library_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t strings_len;
+};
+
+struct library_entry {
+    int64_t mtime;
+    uint64_t size;
+    uint32_t path;
+    uint32_t reserved;
+};
+
+struct library {
+    char *dir_path;
+    char *base;
+    size_t len;
+    unsigned int mapped: 1;
+    struct library_entry *entries;
+    uint32_t count;
+    const char *strings;
+};
+
+int library_open(struct library *library, const char *dir_path);
+void library_free(struct library *library);
+const char *library_string(const struct library *library, uint32_t offset);
+
+#endif
@@ -0,0 +1,133 @@
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "queue.h"
+#include "track.h"
+#include "cache.h"
+#include "loader.h"
+#include "log.h"
+#include "metrics.h"
+
+static void loader_run(struct loader *loader, struct job *job) {
+    uint64_t start;
+    int status;
+
+    if (job->type == JOB_FREE) {
+        track_free(job->track);
+        return;
+    }
+
+    start = metrics_now();
+    status = track_load(job->track, loader->cache);
+    histogram_observe(&metric_load_time, metrics_now() - start);
+    counter_add(status == 0 ? &metric_loads : &metric_load_failures, 1);
+
+    status = queue_push(job->ready, &job->track);
+    if (status == -1) {
+        log_print(LOG_WARN, "loader: ready queue full, dropping %s",
+                  job->track->path);
+        track_free(job->track);
+    }
+}
+
+static void *loader_thread(void *arg) {
+    struct loader *loader = (struct loader *) arg;
+    struct job job;
+    int running;
+
+    if (log_attach("loader") == -1)
+        fprintf(stderr, "loader: logging synchronously\n");
+
+    while (1) {
+        pthread_mutex_lock(&loader->lock);
+        while ((running = loader->running)
+               && queue_pop(&loader->jobs, &job) == -1)
+            pthread_cond_wait(&loader->cond, &loader->lock);
+        pthread_mutex_unlock(&loader->lock);
+
+        if (!running) break;
+
+        loader_run(loader, &job);
+    }
+
+    return NULL;
+}
+
+int loader_new(struct loader *loader, struct cache *cache) {
+    sigset_t set, old;
+    int status;
+
+    loader->cache = cache;
+
+    status = queue_new(&loader->jobs, LOADERJOBS, sizeof(struct job));
+    if (status == -1) return -1;
+
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->cond, NULL);
+    loader->running = 1;
+
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &old);
+
+    status = pthread_create(&loader->thread, NULL, loader_thread, loader);
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (status != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(status));
+        return -1;
+    }
+
+    return 0;
+}
+
+void loader_free(struct loader *loader) {
+    struct job job;
+
+    pthread_mutex_lock(&loader->lock);
+    loader->running = 0;
+    pthread_cond_signal(&loader->cond);
+    pthread_mutex_unlock(&loader->lock);
+
+    pthread_join(loader->thread, NULL);
+
+    while (queue_pop(&loader->jobs, &job) == 0)
+        track_free(job.track);
+
+    pthread_cond_destroy(&loader->cond);
+    pthread_mutex_destroy(&loader->lock);
+    queue_free(&loader->jobs);
+}
+
+int loader_submit(struct loader *loader, enum job_type type,
+                  struct track *track, queue_t *ready)
+{
+    struct job job;
+    int status;
+
+    job.type = type;
+    job.track = track;
+    job.ready = ready;
+
+    status = queue_push(&loader->jobs, &job);
+    if (status == -1) {
+        if (type == JOB_FREE) {
+            track_free(track);
+            return 0;
+        }
+        return -1;
+    }
+
+    pthread_mutex_lock(&loader->lock);
+    pthread_cond_signal(&loader->cond);
+    pthread_mutex_unlock(&loader->lock);
+
+    return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <pthread.h>
+
+#include "queue.h"
+#include "track.h"
+#include "cache.h"
+
+#define LOADERJOBS 1024
+
+enum job_type {
+    JOB_LOAD,
+    JOB_FREE
+};
+
+struct job {
+    enum job_type type;
+    struct track *track;
+    queue_t *ready;
+};
+
+struct loader {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    queue_t jobs;
+    struct cache *cache;
+    int running;
+};
+
+int loader_new(struct loader *loader, struct cache *cache);
+void loader_free(struct loader *loader);
+int loader_submit(struct loader *loader, enum job_type type,
+                  struct track *track, queue_t *ready);
+
+#endif
@@ -0,0 +1,182 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "queue.h"
+#include "log.h"
+
+struct logger {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    enum log_level level;
+    int running;
+    struct log *logs;
+};
+
+static const char *const LEVELS[] = {"debug", "info", "warn", "error"};
+
+static struct logger logger = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .level = LOG_INFO
+};
+
+static __thread struct log *local;
+
+static void log_output(const struct log_record *record, const char *name) {
+    FILE *stream = record->level >= LOG_WARN ? stderr : stdout;
+    char stamp[16];
+    struct tm tm;
+
+    localtime_r(&record->time.tv_sec, &tm);
+    strftime(stamp, sizeof stamp, "%H:%M:%S", &tm);
+
+    fprintf(stream, "%s.%03ld %-5s %s%s%s\n", stamp,
+            record->time.tv_nsec / 1000000, LEVELS[record->level],
+            name != NULL ? name : "", name != NULL ? ": " : "", record->text);
+}
+
+static void log_drain(void) {
+    struct log_record record;
+    struct log *log;
+    uint64_t dropped;
+
+    pthread_mutex_lock(&logger.lock);
+
+    for (log = logger.logs; log != NULL; log = log->next) {
+        while (queue_pop(&log->ring, &record) == 0)
+            log_output(&record, log->name);
+
+        dropped = __atomic_load_n(&log->dropped, __ATOMIC_RELAXED);
+        if (dropped != log->reported) {
+            fprintf(stderr, "log %s: dropped %llu records\n", log->name,
+                    (unsigned long long) (dropped - log->reported));
+            log->reported = dropped;
+        }
+    }
+
+    pthread_mutex_unlock(&logger.lock);
+
+    fflush(stdout);
+    fflush(stderr);
+}
+
+static void *log_thread(void *arg __attribute__((unused))) {
+    struct timespec interval = {0, LOGINTERVAL * 1000000L};
+
+    while (__atomic_load_n(&logger.running, __ATOMIC_ACQUIRE)) {
+        log_drain();
+        nanosleep(&interval, NULL);
+    }
+
+    log_drain();
+
+    return NULL;
+}
+
+int log_start(enum log_level level) {
+    sigset_t set, old;
+    int status;
+
+    logger.level = level;
+    logger.running = 1;
+
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &old);
+
+    status = pthread_create(&logger.thread, NULL, log_thread, NULL);
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (status != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(status));
+        logger.running = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+void log_stop(void) {
+    struct log *log, *next;
+
+    if (!logger.running) return;
+
+    __atomic_store_n(&logger.running, 0, __ATOMIC_RELEASE);
+    pthread_join(logger.thread, NULL);
+
+    for (log = logger.logs; log != NULL; log = next) {
+        next = log->next;
+        queue_free(&log->ring);
+        free(log);
+    }
+
+    logger.logs = NULL;
+    local = NULL;
+}
+
+int log_attach(const char *name) {
+    struct log *log;
+    int status;
+
+    log = (struct log *) calloc(1, sizeof(struct log));
+    if (log == NULL) return -1;
+
+    status = queue_new(&log->ring, LOGRING, sizeof(struct log_record));
+    if (status == -1) {
+        free(log);
+        return -1;
+    }
+
+    snprintf(log->name, sizeof log->name, "%s", name);
+
+    pthread_mutex_lock(&logger.lock);
+    log->next = logger.logs;
+    logger.logs = log;
+    pthread_mutex_unlock(&logger.lock);
+
+    local = log;
+
+    return 0;
+}
+
+int log_parse_level(const char *name, enum log_level *level) {
+    size_t i;
+
+    for (i = 0; i < sizeof LEVELS / sizeof LEVELS[0]; i++) {
+        if (strcmp(name, LEVELS[i]) == 0) {
+            *level = (enum log_level) i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+void log_print(enum log_level level, const char *format, ...) {
+    struct log_record record;
+    va_list args;
+    int status;
+
+    if (level < logger.level) return;
+
+    clock_gettime(CLOCK_REALTIME, &record.time);
+    record.level = level;
+
+    va_start(args, format);
+    vsnprintf(record.text, sizeof record.text, format, args);
+    va_end(args);
+
+    if (local == NULL || !__atomic_load_n(&logger.running, __ATOMIC_ACQUIRE)) {
+        log_output(&record, NULL);
+        return;
+    }
+
+    status = queue_push(&local->ring, &record);
+    if (status == -1)
+        __atomic_add_fetch(&local->dropped, 1, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,42 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "queue.h"
+
+#define LOGRING 4096
+#define LOGLINE 240
+#define LOGINTERVAL 10
+#define LOGNAME 16
+
+enum log_level {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR
+};
+
+struct log_record {
+    struct timespec time;
+    enum log_level level;
+    char text[LOGLINE];
+};
+
+struct log {
+    char name[LOGNAME];
+    queue_t ring;
+    uint64_t dropped;
+    uint64_t reported;
+    struct log *next;
+};
+
+int log_start(enum log_level level);
+void log_stop(void);
+int log_attach(const char *name);
+int log_parse_level(const char *name, enum log_level *level);
+void log_print(enum log_level level, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#endif
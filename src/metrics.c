@@ -0,0 +1,260 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "metrics.h"
+
+struct counter metric_accepted = {
+    "rip_clients_accepted_total", "Connections accepted", METRIC_COUNTER, {{0}}
+};
+struct counter metric_rejected = {
+    "rip_clients_rejected_total", "Connections refused by the per-IP cap",
+    METRIC_COUNTER, {{0}}
+};
+struct counter metric_closed = {
+    "rip_clients_closed_total", "Connections closed", METRIC_COUNTER, {{0}}
+};
+struct counter metric_clients = {
+    "rip_clients", "Connections currently open", METRIC_GAUGE, {{0}}
+};
+struct counter metric_lagged = {
+    "rip_clients_lagged_total", "Connections closed for lagging",
+    METRIC_COUNTER, {{0}}
+};
+struct counter metric_timeouts = {
+    "rip_clients_timed_out_total", "Connections closed by handshake or idle "
+    "timeouts", METRIC_COUNTER, {{0}}
+};
+struct counter metric_bytes = {
+    "rip_sent_bytes_total", "Bytes written to clients", METRIC_COUNTER, {{0}}
+};
+struct counter metric_writes = {
+    "rip_writes_total", "Completed client writes", METRIC_COUNTER, {{0}}
+};
+struct counter metric_eagain = {
+    "rip_writes_eagain_total", "Client writes that hit EAGAIN",
+    METRIC_COUNTER, {{0}}
+};
+struct counter metric_ticks = {
+    "rip_ticks_total", "Ticks processed", METRIC_COUNTER, {{0}}
+};
+struct counter metric_late = {
+    "rip_ticks_late_total", "Timer expirations that arrived together with a "
+    "later one", METRIC_COUNTER, {{0}}
+};
+struct counter metric_overruns = {
+    "rip_ticks_dropped_total", "Ticks dropped by timer overruns",
+    METRIC_COUNTER, {{0}}
+};
+struct counter metric_inbox_dropped = {
+    "rip_inbox_dropped_total", "Packets dropped for a shard a full ring "
+    "behind", METRIC_COUNTER, {{0}}
+};
+struct counter metric_loads = {
+    "rip_track_loads_total", "Tracks loaded", METRIC_COUNTER, {{0}}
+};
+struct counter metric_load_failures = {
+    "rip_track_load_failures_total", "Tracks that failed to load",
+    METRIC_COUNTER, {{0}}
+};
+
+struct histogram metric_tick_jitter = {
+    "rip_tick_jitter_seconds", "Delay between a tick's deadline and its "
+    "handling", 1e9, 10, 32, {{0, 0, {0}}}
+};
+struct histogram metric_fanout = {
+    "rip_fanout_seconds", "Time from publishing a tick to the end of a "
+    "shard's fan-out pass", 1e9, 10, 32, {{0, 0, {0}}}
+};
+struct histogram metric_write_size = {
+    "rip_write_size_bytes", "Bytes accepted per client write", 1, 4, 24,
+    {{0, 0, {0}}}
+};
+struct histogram metric_load_time = {
+    "rip_track_load_seconds", "Time to map and frame a track", 1e9, 10, 34,
+    {{0, 0, {0}}}
+};
+
+static struct counter *const COUNTERS[] = {
+    &metric_accepted, &metric_rejected, &metric_closed, &metric_clients,
+    &metric_lagged, &metric_timeouts, &metric_bytes, &metric_writes,
+    &metric_eagain, &metric_ticks, &metric_late, &metric_overruns,
+    &metric_inbox_dropped, &metric_loads, &metric_load_failures
+};
+
+static struct histogram *const HISTOGRAMS[] = {
+    &metric_tick_jitter, &metric_fanout, &metric_write_size,
+    &metric_load_time
+};
+
+static unsigned int bucket_index(uint64_t value) {
+    unsigned int shift;
+
+    if (value < HISTOGRAMSTEPS) return value;
+
+    shift = 63 - __builtin_clzll(value);
+    return shift * HISTOGRAMSTEPS
+        + ((value >> (shift - 2)) & (HISTOGRAMSTEPS - 1));
+}
+
+static uint64_t bucket_bound(unsigned int index) {
+    unsigned int shift = index / HISTOGRAMSTEPS;
+
+    if (index < HISTOGRAMSTEPS) return index;
+
+    return ((uint64_t) (HISTOGRAMSTEPS + index % HISTOGRAMSTEPS + 1)
+            << (shift - 2)) - 1;
+}
+
+static __thread unsigned int slot;
+
+void metrics_attach(unsigned int index) {
+    slot = index % METRICSLOTS;
+}
+
+uint64_t metrics_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void counter_add(struct counter *counter, uint64_t value) {
+    __atomic_add_fetch(&counter->slots[slot].value, value, __ATOMIC_RELAXED);
+}
+
+void counter_sub(struct counter *counter, uint64_t value) {
+    __atomic_sub_fetch(&counter->slots[slot].value, value, __ATOMIC_RELAXED);
+}
+
+static uint64_t counter_value(const struct counter *counter) {
+    uint64_t value = 0;
+    unsigned int i;
+
+    for (i = 0; i < METRICSLOTS; i++)
+        value += __atomic_load_n(&counter->slots[i].value, __ATOMIC_RELAXED);
+
+    return value;
+}
+
+void histogram_observe(struct histogram *histogram, uint64_t value) {
+    struct histogram_slot *local = &histogram->slots[slot];
+
+    __atomic_add_fetch(&local->buckets[bucket_index(value)], 1,
+                       __ATOMIC_RELAXED);
+    __atomic_add_fetch(&local->sum, value, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&local->count, 1, __ATOMIC_RELAXED);
+}
+
+static uint64_t histogram_bucket(const struct histogram *histogram,
+                                 unsigned int index)
+{
+    uint64_t value = 0;
+    unsigned int i;
+
+    for (i = 0; i < METRICSLOTS; i++)
+        value += __atomic_load_n(&histogram->slots[i].buckets[index],
+                                 __ATOMIC_RELAXED);
+
+    return value;
+}
+
+static uint64_t histogram_sum(const struct histogram *histogram) {
+    uint64_t value = 0;
+    unsigned int i;
+
+    for (i = 0; i < METRICSLOTS; i++)
+        value += __atomic_load_n(&histogram->slots[i].sum, __ATOMIC_RELAXED);
+
+    return value;
+}
+
+uint64_t histogram_count(const struct histogram *histogram) {
+    uint64_t value = 0;
+    unsigned int i;
+
+    for (i = 0; i < METRICSLOTS; i++)
+        value += __atomic_load_n(&histogram->slots[i].count,
+                                 __ATOMIC_RELAXED);
+
+    return value;
+}
+
+uint64_t histogram_quantile(const struct histogram *histogram, double q) {
+    uint64_t buckets[HISTOGRAMBUCKETS], total = 0, seen = 0, rank;
+    unsigned int i;
+
+    for (i = 0; i < HISTOGRAMBUCKETS; i++) {
+        buckets[i] = histogram_bucket(histogram, i);
+        total += buckets[i];
+    }
+    if (total == 0) return 0;
+
+    rank = (uint64_t) (q * (total - 1)) + 1;
+
+    for (i = 0; i < HISTOGRAMBUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank) return bucket_bound(i);
+    }
+
+    return bucket_bound(HISTOGRAMBUCKETS - 1);
+}
+
+static size_t render_counter(char *out, size_t len,
+                             const struct counter *counter)
+{
+    return snprintf(out, len, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n",
+                    counter->name, counter->help, counter->name,
+                    counter->type == METRIC_GAUGE ? "gauge" : "counter",
+                    counter->name,
+                    (unsigned long long) counter_value(counter));
+}
+
+static size_t render_histogram(char *out, size_t len,
+                               const struct histogram *histogram)
+{
+    unsigned int i, first, last;
+    uint64_t total = 0;
+    size_t n;
+
+    first = histogram->min_shift * HISTOGRAMSTEPS;
+    last = (histogram->max_shift + 1) * HISTOGRAMSTEPS;
+
+    n = snprintf(out, len, "# HELP %s %s\n# TYPE %s histogram\n",
+                 histogram->name, histogram->help, histogram->name);
+
+    for (i = 0; i < HISTOGRAMBUCKETS; i++) {
+        total += histogram_bucket(histogram, i);
+        if (i < first || i >= last || n >= len) continue;
+
+        n += snprintf(out + n, len - n, "%s_bucket{le=\"%.9g\"} %llu\n",
+                      histogram->name,
+                      (double) bucket_bound(i) / histogram->scale,
+                      (unsigned long long) total);
+    }
+
+    if (n >= len) return n;
+
+    n += snprintf(out + n, len - n,
+                  "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.9g\n%s_count %llu\n",
+                  histogram->name, (unsigned long long) total,
+                  histogram->name,
+                  (double) histogram_sum(histogram) / histogram->scale,
+                  histogram->name, (unsigned long long) total);
+
+    return n;
+}
+
+size_t metrics_render(char *out, size_t len) {
+    size_t i, n = 0;
+
+    for (i = 0; i < sizeof COUNTERS / sizeof COUNTERS[0] && n < len; i++)
+        n += render_counter(out + n, len - n, COUNTERS[i]);
+
+    for (i = 0; i < sizeof HISTOGRAMS / sizeof HISTOGRAMS[0] && n < len; i++)
+        n += render_histogram(out + n, len - n, HISTOGRAMS[i]);
+
+    return n < len ? n : len - 1;
+}
@@ -0,0 +1,74 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HISTOGRAMSTEPS 4
+#define HISTOGRAMBUCKETS (64 * HISTOGRAMSTEPS)
+#define METRICSBACKLOG 16
+#define METRICSBUFFER (256 * 1024)
+#define METRICSLOTS 16
+
+enum metric_type {
+    METRIC_COUNTER,
+    METRIC_GAUGE
+};
+
+struct counter_slot {
+    uint64_t value;
+} __attribute__((aligned(64)));
+
+struct counter {
+    const char *name;
+    const char *help;
+    enum metric_type type;
+    struct counter_slot slots[METRICSLOTS];
+};
+
+struct histogram_slot {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t buckets[HISTOGRAMBUCKETS];
+} __attribute__((aligned(64)));
+
+struct histogram {
+    const char *name;
+    const char *help;
+    double scale;
+    unsigned int min_shift;
+    unsigned int max_shift;
+    struct histogram_slot slots[METRICSLOTS];
+};
+
+extern struct counter metric_accepted;
+extern struct counter metric_rejected;
+extern struct counter metric_closed;
+extern struct counter metric_clients;
+extern struct counter metric_lagged;
+extern struct counter metric_timeouts;
+extern struct counter metric_bytes;
+extern struct counter metric_writes;
+extern struct counter metric_eagain;
+extern struct counter metric_ticks;
+extern struct counter metric_late;
+extern struct counter metric_overruns;
+extern struct counter metric_inbox_dropped;
+extern struct counter metric_loads;
+extern struct counter metric_load_failures;
+
+extern struct histogram metric_tick_jitter;
+extern struct histogram metric_fanout;
+extern struct histogram metric_write_size;
+extern struct histogram metric_load_time;
+
+uint64_t metrics_now(void);
+void metrics_attach(unsigned int slot);
+void counter_add(struct counter *counter, uint64_t value);
+void counter_sub(struct counter *counter, uint64_t value);
+void histogram_observe(struct histogram *histogram, uint64_t value);
+uint64_t histogram_count(const struct histogram *histogram);
+uint64_t histogram_quantile(const struct histogram *histogram, double q);
+size_t metrics_render(char *out, size_t len);
+
+#endif
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "packet.h"
+
+struct packet *packet_new(size_t len) {
+    struct packet *packet;
+
+    packet = (struct packet *) malloc(sizeof(struct packet) + len);
+    if (packet == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+
+    packet->refs = 1;
+    packet->len = len;
+    packet->head_len = len;
+    packet->body = NULL;
+    packet->release = NULL;
+    packet->owner = NULL;
+
+    return packet;
+}
+
+struct packet *packet_new_view(size_t head_len, const char *body,
+                               size_t body_len, void (*release)(void *),
+                               void *owner)
+{
+    struct packet *packet;
+
+    packet = packet_new(head_len);
+    if (packet == NULL) return NULL;
+
+    packet->len = head_len + body_len;
+    packet->body = body;
+    packet->release = release;
+    packet->owner = owner;
+
+    return packet;
+}
+
+struct packet *packet_ref(struct packet *packet) {
+    __atomic_add_fetch(&packet->refs, 1, __ATOMIC_RELAXED);
+    return packet;
+}
+
+void packet_unref(struct packet *packet) {
+    if (packet == NULL) return;
+
+    if (__atomic_sub_fetch(&packet->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (packet->release != NULL)
+            packet->release(packet->owner);
+        free(packet);
+    }
+}
+
+int packet_iov(const struct packet *packet, size_t offset, struct iovec *iov) {
+    int count = 0;
+
+    if (offset < packet->head_len) {
+        iov[count].iov_base = (char *) packet->data + offset;
+        iov[count].iov_len = packet->head_len - offset;
+        count++;
+        offset = 0;
+    } else {
+        offset -= packet->head_len;
+    }
+
+    if (packet->body != NULL && offset < packet->len - packet->head_len) {
+        iov[count].iov_base = (char *) packet->body + offset;
+        iov[count].iov_len = packet->len - packet->head_len - offset;
+        count++;
+    }
+
+    return count;
+}
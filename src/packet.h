@@ -0,0 +1,25 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include <stdlib.h>
+#include <sys/uio.h>
+
+struct packet {
+    size_t refs;
+    size_t len;
+    size_t head_len;
+    const char *body;
+    void (*release)(void *owner);
+    void *owner;
+    char data[];
+};
+
+struct packet *packet_new(size_t len);
+struct packet *packet_new_view(size_t head_len, const char *body,
+                               size_t body_len, void (*release)(void *),
+                               void *owner);
+struct packet *packet_ref(struct packet *packet);
+void packet_unref(struct packet *packet);
+int packet_iov(const struct packet *packet, size_t offset, struct iovec *iov);
+
+#endif
@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "queue.h"
+
+int queue_new(queue_t *queue, size_t capacity, size_t element_size) {
+    queue->entries = (char *) malloc(capacity * element_size);
+    if (queue->entries == NULL) return -1;
+
+    queue->element_size = element_size;
+    queue->capacity = capacity;
+
+    queue->head = 0;
+    queue->tail = 0;
+
+    return 0;
+}
+
+void queue_free(queue_t *queue) {
+    free(queue->entries);
+
+    queue->entries = NULL;
+    queue->element_size = 0;
+    queue->capacity = 0;
+
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+int queue_push(queue_t *queue, const void *element) {
+    size_t head, tail;
+
+    head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail == queue->capacity) return -1;
+
+    memcpy(queue->entries + (head % queue->capacity) * queue->element_size,
+           element, queue->element_size);
+
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+int queue_pop(queue_t *queue, void *element) {
+    size_t head, tail;
+
+    tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+    if (head == tail) return -1;
+
+    memcpy(element,
+           queue->entries + (tail % queue->capacity) * queue->element_size,
+           queue->element_size);
+
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
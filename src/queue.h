@@ -0,0 +1,20 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdlib.h>
+
+typedef struct queue {
+    char *entries;
+    size_t element_size;
+    size_t capacity;
+
+    size_t head;
+    size_t tail;
+} queue_t;
+
+int queue_new(queue_t *queue, size_t capacity, size_t element_size);
+void queue_free(queue_t *queue);
+int queue_push(queue_t *queue, const void *element);
+int queue_pop(queue_t *queue, void *element);
+
+#endif
@@ -0,0 +1,234 @@
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "rip.h"
+#include "packet.h"
+#include "relay.h"
+#include "log.h"
+
+int relay_new(struct relay *relay, int feed, const char *name,
+              const struct sockaddr *addr, socklen_t addrlen, void *owner)
+{
+    memset(relay, 0, sizeof *relay);
+    relay->handle.fd = -1;
+    relay->owner = owner;
+    relay->feed = feed;
+    relay->name = name;
+    relay->addr = addr;
+    relay->addrlen = addrlen;
+    relay->played = -1;
+
+    if (strlen(name) > 255) {
+        fprintf(stderr, "relay: station id too long: %s\n", name);
+        return -1;
+    }
+
+    relay->buf = (char *) malloc(RELAYBUFFER);
+    if (relay->buf == NULL) return -1;
+    relay->cap = RELAYBUFFER;
+
+    return 0;
+}
+
+void relay_free(struct relay *relay) {
+    if (relay->handle.fd != -1) close(relay->handle.fd);
+    packet_unref(relay->metadata);
+    free(relay->buf);
+}
+
+int relay_connect(struct relay *relay) {
+    int fd, status;
+
+    fd = socket(relay->addr->sa_family,
+                SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    status = connect(fd, relay->addr, relay->addrlen);
+    if (status == -1 && errno != EINPROGRESS) {
+        log_print(LOG_WARN, "upstream: connect station=%s: %s", relay->name,
+                  strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    relay->handle.fd = fd;
+    relay->connected = 0;
+    relay->start = relay->len = 0;
+
+    return 0;
+}
+
+int relay_ready(struct relay *relay) {
+    char hello[257];
+    size_t len = strlen(relay->name);
+    socklen_t optlen = sizeof(int);
+    int error = 0, status;
+    ssize_t count;
+
+    status = getsockopt(relay->handle.fd, SOL_SOCKET, SO_ERROR, &error,
+                        &optlen);
+    if (status == -1) error = errno;
+
+    if (error != 0) {
+        log_print(LOG_WARN, "upstream: connect station=%s: %s", relay->name,
+                  strerror(error));
+        return -1;
+    }
+
+    hello[0] = HELLOSTATION;
+    hello[1] = len;
+    memcpy(hello + 2, relay->name, len);
+
+    count = send(relay->handle.fd, hello, len + 2, MSG_NOSIGNAL);
+    if (count != (ssize_t) len + 2) {
+        log_print(LOG_WARN, "upstream: hello station=%s failed", relay->name);
+        return -1;
+    }
+
+    relay->connected = 1;
+
+    log_print(LOG_INFO, "upstream: connected fd=%d station=%s",
+              relay->handle.fd, relay->name);
+
+    return 0;
+}
+
+ssize_t relay_fill(struct relay *relay) {
+    ssize_t count;
+    char *buf;
+
+    if (relay->start > 0) {
+        memmove(relay->buf, relay->buf + relay->start,
+                relay->len - relay->start);
+        relay->len -= relay->start;
+        relay->start = 0;
+    }
+
+    if (relay->len == relay->cap) {
+        buf = (char *) realloc(relay->buf, relay->cap * 2);
+        if (buf == NULL) return -1;
+
+        relay->buf = buf;
+        relay->cap *= 2;
+    }
+
+    count = recv(relay->handle.fd, relay->buf + relay->len,
+                 relay->cap - relay->len, 0);
+    if (count == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+
+        log_print(LOG_WARN, "upstream: recv station=%s: %s", relay->name,
+                  strerror(errno));
+        return -1;
+    }
+
+    if (count == 0) {
+        log_print(LOG_WARN, "upstream: closed station=%s", relay->name);
+        return -1;
+    }
+
+    relay->len += count;
+    return count;
+}
+
+static int relay_frame(struct relay *relay, struct packet **packet) {
+    const char *frame = relay->buf + relay->start;
+    size_t len = relay->len - relay->start, need;
+    uint32_t u32;
+    uint16_t u16;
+    int i;
+
+    if (len == 0) return 0;
+
+    if (frame[0] == 2) {
+        if (len < HEADERSIZE) return 0;
+
+        memcpy(&u32, frame + 1, 4);
+        need = HEADERSIZE + (size_t) be32toh(u32);
+    } else if (frame[0] == 1) {
+        need = 5;
+
+        for (i = 0; i < 3; i++) {
+            if (len < need + 2) return 0;
+
+            memcpy(&u16, frame + need, 2);
+            need += 2 + be16toh(u16);
+        }
+    } else {
+        log_print(LOG_WARN, "upstream: bad packet type %d station=%s",
+                  frame[0], relay->name);
+        return -1;
+    }
+
+    if (need > RELAYMAXFRAME) {
+        log_print(LOG_WARN, "upstream: oversized packet station=%s",
+                  relay->name);
+        return -1;
+    }
+
+    if (len < need) return 0;
+
+    *packet = packet_new(need);
+    if (*packet == NULL) return -1;
+
+    memcpy((*packet)->data, frame, need);
+    relay->start += need;
+
+    return 1;
+}
+
+static int relay_fresh(struct relay *relay, struct packet *packet) {
+    uint32_t u32;
+
+    if (packet->data[0] == 1) {
+        if (relay->resync && relay->metadata != NULL
+            && relay->metadata->len == packet->len
+            && memcmp(relay->metadata->data, packet->data, packet->len) == 0)
+            return 0;
+
+        packet_unref(relay->metadata);
+        relay->metadata = packet_ref(packet);
+        relay->played = -1;
+        relay->resync = 0;
+        return 1;
+    }
+
+    memcpy(&u32, packet->data + 5, 4);
+    if (relay->resync && (int64_t) be32toh(u32) <= relay->played) return 0;
+
+    relay->played = be32toh(u32);
+    relay->resync = 0;
+    return 1;
+}
+
+int relay_next(struct relay *relay, struct packet **packet) {
+    int status;
+
+    while ((status = relay_frame(relay, packet)) == 1) {
+        if (relay_fresh(relay, *packet)) return 1;
+        packet_unref(*packet);
+    }
+
+    return status;
+}
+
+void relay_close(struct relay *relay) {
+    close(relay->handle.fd);
+    relay->handle.fd = -1;
+    relay->connected = 0;
+    relay->resync = relay->metadata != NULL;
+    relay->start = relay->len = 0;
+}
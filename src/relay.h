@@ -0,0 +1,46 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "packet.h"
+#include "shard.h"
+
+#define RELAYBUFFER 65536
+#define RELAYMAXFRAME (1 << 20)
+#define RELAYRETRY 2000
+
+struct relay {
+    struct handle handle;
+    void *owner;
+    int feed;
+    const char *name;
+
+    const struct sockaddr *addr;
+    socklen_t addrlen;
+    int connected;
+    uint64_t retry;
+
+    struct packet *metadata;
+    int64_t played;
+    int resync;
+
+    char *buf;
+    size_t start;
+    size_t len;
+    size_t cap;
+};
+
+int relay_new(struct relay *relay, int feed, const char *name,
+              const struct sockaddr *addr, socklen_t addrlen, void *owner);
+void relay_free(struct relay *relay);
+int relay_connect(struct relay *relay);
+int relay_ready(struct relay *relay);
+ssize_t relay_fill(struct relay *relay);
+int relay_next(struct relay *relay, struct packet **packet);
+void relay_close(struct relay *relay);
+
+#endif
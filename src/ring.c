@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ring.h"
+
+int ring_new(ring_t *ring, size_t capacity) {
+    ring->slots = (struct packet **) calloc(capacity, sizeof(struct packet *));
+    if (ring->slots == NULL) return -1;
+
+    ring->capacity = capacity;
+    ring->head = 0;
+
+    return 0;
+}
+
+void ring_free(ring_t *ring) {
+    size_t i;
+
+    for (i = 0; i < ring->capacity; i++)
+        packet_unref(ring->slots[i]);
+
+    free(ring->slots);
+
+    ring->slots = NULL;
+    ring->capacity = 0;
+    ring->head = 0;
+}
+
+uint64_t ring_tail(ring_t *ring) {
+    if (ring->head < ring->capacity) return 0;
+    return ring->head - ring->capacity;
+}
+
+void ring_push(ring_t *ring, struct packet *packet) {
+    struct packet **slot = &ring->slots[ring->head % ring->capacity];
+
+    packet_unref(*slot);
+    *slot = packet;
+
+    ring->head++;
+}
+
+struct packet *ring_get(ring_t *ring, uint64_t seq) {
+    if (seq >= ring->head || seq < ring_tail(ring)) return NULL;
+    return ring->slots[seq % ring->capacity];
+}
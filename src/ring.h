@@ -0,0 +1,22 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "packet.h"
+
+typedef struct ring {
+    struct packet **slots;
+    size_t capacity;
+
+    uint64_t head;
+} ring_t;
+
+int ring_new(ring_t *ring, size_t capacity);
+void ring_free(ring_t *ring);
+uint64_t ring_tail(ring_t *ring);
+void ring_push(ring_t *ring, struct packet *packet);
+struct packet *ring_get(ring_t *ring, uint64_t seq);
+
+#endif
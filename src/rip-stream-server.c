@@ -8,19 +8,28 @@
 #include <signal.h>
 #include <netdb.h>
 #include <unistd.h>
-#include <fcntl.h>
 #include <errno.h>
-#include <dirent.h> 
 #include <sys/types.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <sys/timerfd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <fcntl.h>
+#include <pthread.h>
 
-#include "slab.h"
 #include "rip.h"
+#include "packet.h"
+#include "shard.h"
+#include "station.h"
+#include "log.h"
 #include "rip-stream-server.h"
 
-static int bind_listener(const char *service) {
+static int bind_listener(const char *service, int reuseport, int defer) {
     struct addrinfo *result, *rp;
     int status, sfd;
 
@@ -38,9 +47,26 @@ static int bind_listener(const char *service) {
     }
 
     for (rp = result; rp != NULL; rp = rp->ai_next) {
-        sfd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        sfd = socket(rp->ai_family, rp->ai_socktype | SOCK_CLOEXEC,
+                     rp->ai_protocol);
         if (sfd == -1) continue;
 
+        if (reuseport) {
+            status = setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &reuseport,
+                                sizeof reuseport);
+            if (status == -1) {
+                perror("setsockopt");
+                close(sfd);
+                continue;
+            }
+        }
+
+        if (defer) {
+            status = setsockopt(sfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer,
+                                sizeof defer);
+            if (status == -1) perror("setsockopt");
+        }
+
         status = bind(sfd, rp->ai_addr, rp->ai_addrlen);
         if (status == 0) break;
 
@@ -57,45 +83,36 @@ static int bind_listener(const char *service) {
     return sfd;
 }
 
-static int set_nonblock(int sfd) {
-    int flags, status;
+static int create_timer(unsigned int interval, uint64_t *tick) {
+    int status, timerfd;
+    struct timespec now;
+    uint64_t period, next;
+    struct itimerspec timespec;
 
-    flags = fcntl(sfd, F_GETFL);
-    if (flags == -1) {
-        perror("fcntl");
-        return -1;
-    }
+    period = (uint64_t) interval * 1000000;
 
-    flags |= O_NONBLOCK;
-    status = fcntl(sfd, F_SETFL, flags); 
+    status = clock_gettime(CLOCK_MONOTONIC, &now);
     if (status == -1) {
-        perror("fcntl");
+        perror("clock_gettime");
         return -1;
     }
 
-    return 0;
-}
+    next = ((uint64_t) now.tv_sec * 1000000000 + now.tv_nsec) / period + 1;
+    *tick = next - 1;
+    next *= period;
 
-static int create_timer(void) {
-    int status, timerfd;
-    struct itimerspec timespec = {
-        .it_interval = {
-            .tv_sec = 1,
-            .tv_nsec = 0
-        },
-        .it_value = {
-            .tv_sec = 1,
-            .tv_nsec = 0
-        }
-    };
+    timespec.it_interval.tv_sec = period / 1000000000;
+    timespec.it_interval.tv_nsec = period % 1000000000;
+    timespec.it_value.tv_sec = next / 1000000000;
+    timespec.it_value.tv_nsec = next % 1000000000;
 
-    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
     if (timerfd == -1) {
         perror("timerfd_create");
         return -1;
     }
 
-    status = timerfd_settime(timerfd, 0, &timespec, NULL);
+    status = timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &timespec, NULL);
     if (status == -1) {
         perror("timerfd_settime");
         return -1;
@@ -104,423 +121,993 @@ static int create_timer(void) {
     return timerfd;
 }
 
-static int listener_accept(int sfd, int efd, slab_t *clients) {
-    int status;
-    struct epoll_event event;
+static int server_publish(struct server *server, int station,
+                          struct packet *packet)
+{
+    int i;
 
-    while (1) {
-        int infd, index;
-        struct sockaddr in_addr;
-        char host[NI_MAXHOST], serv[NI_MAXSERV];
-        struct client client;
-        socklen_t in_addrlen = sizeof in_addr;
-
-        infd = accept(sfd, &in_addr, &in_addrlen);
-        if (infd == -1) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
-            perror("accept");
-            break;
-        }
+    for (i = 0; i < server->shards_len; i++)
+        shard_publish(&server->shards[i], station, packet);
 
-        status = getnameinfo(&in_addr, in_addrlen, host, sizeof host,
-                             serv, sizeof serv,
-                             NI_NUMERICHOST | NI_NUMERICSERV);
-        if (status == 0)
-            printf("accepted %s:%s on %d fd\n", host, serv, infd);
-        
-        status = set_nonblock(infd);
-        if (status == -1)
-            return -1;
+    return 0;
+}
 
-        client.fd = infd;
-        client.initialized = 0;
-        client.wrote = 0;
-        client.needs_metadata = 1;
+static int server_notify(struct server *server) {
+    int i, status;
 
-        index = slab_insert(clients, &client);
-        if (index == -1) {
-            return -1;
-        }
+    for (i = 0; i < server->shards_len; i++) {
+        status = shard_notify(&server->shards[i]);
+        if (status == -1) return -1;
+    }
 
-        event.data.ptr = slab_get(clients, index);
-        ((struct client *) event.data.ptr)->index = index;
-        event.events = EPOLLIN | EPOLLONESHOT;
+    return 0;
+}
 
-        status = epoll_ctl(efd, EPOLL_CTL_ADD, infd, &event);
-        if (status == -1) {
-            perror("epoll_ctl");
-            return -1;
+static int server_tick(struct server *server, uint64_t expirations) {
+    struct packet *packets[MAXTICKPACKETS];
+    int i, j, n;
+
+    counter_add(&metric_ticks, expirations);
+
+    if (expirations > MAXCATCHUP) {
+        counter_add(&metric_overruns, expirations - MAXCATCHUP);
+        log_print(LOG_WARN, "timer overrun, dropped %llu ticks",
+                  (unsigned long long) (expirations - MAXCATCHUP));
+        expirations = MAXCATCHUP;
+    }
+
+    while (expirations-- > 0) {
+        server->pacer.ticks++;
+
+        for (i = 0; i < server->stations_len; i++) {
+            n = station_tick(&server->stations[i], packets, MAXTICKPACKETS);
+            if (n == -1) return -1;
+
+            for (j = 0; j < n; j++) {
+                server_publish(server, i, packets[j]);
+                packet_unref(packets[j]);
+            }
         }
     }
 
-    return 0;
+    return server_notify(server);
 }
 
-static int timer_read(int timerfd, int efd, slab_t *clients,
-                      char *chunk, size_t *chunk_len, FILE **rip_file,
-                      char **playlist, int *current_song, int playlist_size,
-                      struct rip_metadata *metadata, char **metadata_out,
-                      size_t *metadata_out_len, uint32_t *rip_time)
+static int timer_read(struct handle *handle,
+                      uint32_t events __attribute__((unused)))
 {
-    struct epoll_event event;
+    struct server *server = container_of(handle, struct server, timer);
+    uint64_t expirations, deadline, now;
     ssize_t count;
-    struct client *client;
-    ssize_t time;
-    int status, next = 0;
-    slab_iter_t iter;
+    int status;
+
+    count = read(handle->fd, &expirations, 8);
+    if (count != 8) return count == -1 && errno == EAGAIN ? 0 : -1;
+
+    now = metrics_now();
+    server->pacer.last += expirations;
+    deadline = server->pacer.last * server->pacer.interval * 1000000;
+    histogram_observe(&metric_tick_jitter,
+                      now > deadline ? now - deadline : 0);
+    counter_add(&metric_late, expirations - 1);
+
+    status = server_reconnect(server);
+    if (status == -1) return -1;
+
+    return server_tick(server, expirations);
+}
 
-    count = read(timerfd, &time, 8);
-    if (count != 8) return -1; 
+static int resolve_upstream(const char *address,
+                            struct sockaddr_storage *addr, socklen_t *len)
+{
+    const char *port = strrchr(address, ':');
+    struct addrinfo hints, *result;
+    char host[NI_MAXHOST];
+    int status;
 
-    *chunk_len = rip_read_chunk(*rip_file, chunk, rip_time);
-    if (*chunk_len == (size_t) -1)
+    if (port == NULL || (size_t) (port - address) >= sizeof host) {
+        fprintf(stderr, "upstream: expected host:port, got %s\n", address);
         return -1;
-    else if (*chunk_len == 0) {
-        *current_song += 1;
+    }
 
-        if (*current_song >= playlist_size) *current_song = 0;
-        status = load_song(playlist[*current_song], metadata,
-                  metadata_out, metadata_out_len, rip_time, rip_file);
-        if (status == -1) return -1;
-        next = 1;
+    memcpy(host, address, port - address);
+    host[port - address] = '\0';
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    status = getaddrinfo(host, port + 1, &hints, &result);
+    if (status != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(status));
+        return -1;
     }
 
-    event.events = EPOLLOUT | EPOLLET;
+    memcpy(addr, result->ai_addr, result->ai_addrlen);
+    *len = result->ai_addrlen;
+    freeaddrinfo(result);
 
-    for (slab_iter_create(clients, &iter); !slab_iter_done(&iter);
-         slab_iter_next(clients, &iter))
-    {
-        client = (struct client *) iter.data;
-        if (client->initialized) {
-            client->wrote = 0;
-            client->needs_metadata = next;
-            event.data.ptr = client;
+    return 0;
+}
 
-            status = epoll_ctl(efd, EPOLL_CTL_MOD, client->fd, &event);
+static int relay_start(struct server *server, struct relay *relay) {
+    if (relay_connect(relay) == -1) return relay_lost(server, relay);
 
-            if (status == -1) {
-                perror("epoll_ctl");
-                return -1;
-            }
-        } 
-    }
+    return shard_watch(&server->shards[0], &relay->handle,
+                       EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+}
+
+static int relay_lost(struct server *server, struct relay *relay) {
+    if (relay->handle.fd != -1) relay_close(relay);
+    relay->retry = server->pacer.ticks + RELAYRETRY / server->pacer.interval
+        + 1;
 
     return 0;
 }
 
-static int client_read(struct client *client, slab_t *clients, int efd) {
+static int relay_event(struct handle *handle, uint32_t events) {
+    struct relay *relay = container_of(handle, struct relay, handle);
+    struct server *server = (struct server *) relay->owner;
+    struct packet *packet;
     ssize_t count;
-    struct epoll_event event;
-    char buf;
-    int status, closing = 0;
-
-    count = recv(client->fd, &buf, sizeof(char), 0);
-    if (count == -1) {
-        if (errno != EAGAIN) {
-            closing = 1;
+    int status = 0;
+
+    if (!relay->connected) {
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) return 0;
+        if (relay_ready(relay) == -1) return relay_lost(server, relay);
+    }
+
+    while ((count = relay_fill(relay)) > 0) {
+        while ((status = relay_next(relay, &packet)) == 1) {
+            server_publish(server, relay->feed, packet);
+            packet_unref(packet);
         }
+
+        if (status == -1) break;
     }
 
-    if (count == 0 || buf != '\0') closing = 1;
+    if (server_notify(server) == -1) return -1;
 
-    if (closing) {
-        client_close(client, clients, efd);
-    } else {
-        event.data.ptr = client;
-        event.events = EPOLLOUT | EPOLLET;
+    if (count == -1 || status == -1) return relay_lost(server, relay);
 
-        status = epoll_ctl(efd, EPOLL_CTL_MOD, client->fd, &event);
-        if (status == -1) {
-            perror("epoll_ctl");
-            return -1;
-        }
+    return 0;
+}
 
-        client->initialized = 1;
+static int server_reconnect(struct server *server) {
+    struct relay *relay;
+    int i, status;
 
-        printf("initialized %d fd\n", client->fd);
+    for (i = 0; i < server->relays_len; i++) {
+        relay = &server->relays[i];
+        if (relay->handle.fd != -1 || server->pacer.ticks < relay->retry)
+            continue;
+
+        status = relay_start(server, relay);
+        if (status == -1) return -1;
     }
 
     return 0;
 }
 
-static int client_write(struct client *client, const char *buf, size_t len,
-                        slab_t *clients, int efd)
+static int create_watcher(struct server *server) {
+    struct station *station;
+    int i, fd;
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1) {
+        perror("inotify_init1");
+        return -1;
+    }
+
+    for (i = 0; i < server->stations_len; i++) {
+        station = &server->stations[i];
+        station->watch = -1;
+        if (station->archive != NULL) continue;
+
+        station->watch = inotify_add_watch(fd, station->library.dir_path,
+                                           WATCHMASK);
+        if (station->watch == -1) {
+            perror("inotify_add_watch");
+            close(fd);
+            return -1;
+        }
+    }
+
+    return fd;
+}
+
+static int watcher_read(struct handle *handle,
+                        uint32_t events __attribute__((unused)))
 {
-    int closing;
+    struct server *server = container_of(handle, struct server, watcher);
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    struct station *station;
     ssize_t count;
+    char *dot, *p;
+    int i;
 
-    closing = 0;
+    while (1) {
+        count = read(handle->fd, buf, sizeof buf);
+        if (count == -1) {
+            if (errno == EAGAIN || errno == EINTR) return 0;
+            perror("read");
+            return -1;
+        }
 
-    if (len == 0) closing = 1;
+        for (p = buf; p < buf + count;
+             p += sizeof(struct inotify_event) + event->len)
+        {
+            event = (const struct inotify_event *) p;
 
-    while (client->wrote < len) {
-        count = send(client->fd, buf + client->wrote, len - client->wrote, MSG_NOSIGNAL);
-        if (count == -1) {
-            if (errno != EAGAIN) {
-                closing = 1;
+            if (event->mask & IN_Q_OVERFLOW) {
+                log_print(LOG_WARN, "watcher: event queue overflow, "
+                          "playlists may be stale until restart");
+                continue;
             }
-            break;
-        } else if (count == 0) {
-            closing = 1;
-            break;
+
+            station = NULL;
+            for (i = 0; i < server->stations_len; i++) {
+                if (server->stations[i].watch == event->wd) {
+                    station = &server->stations[i];
+                    break;
+                }
+            }
+            if (station == NULL) continue;
+
+            if (event->mask & IN_DELETE_SELF) {
+                log_print(LOG_WARN, "station=%s playlist directory removed",
+                          station->name);
+                continue;
+            }
+
+            if (event->len == 0 || event->mask & IN_ISDIR) continue;
+
+            dot = strrchr(event->name, '.');
+            if (!dot || strcmp(dot, ".rip")) continue;
+
+            if (event->mask & IN_CLOSE_WRITE)
+                station_changed(station, event->name);
+
+            if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                station_add(station, event->name);
+            else
+                station_remove(station, event->name);
+        }
+    }
+}
+
+static int create_metrics(const char *address) {
+    struct sockaddr_un unix_addr;
+    struct sockaddr_in inet_addr;
+    int status, fd;
+
+    if (strchr(address, '/') != NULL) {
+        memset(&unix_addr, 0, sizeof unix_addr);
+        unix_addr.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof unix_addr.sun_path) {
+            fprintf(stderr, "metrics: socket path too long\n");
+            return -1;
+        }
+        strcpy(unix_addr.sun_path, address);
+        unlink(address);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+            perror("socket");
+            return -1;
+        }
+
+        status = bind(fd, (struct sockaddr *) &unix_addr, sizeof unix_addr);
+    } else {
+        memset(&inet_addr, 0, sizeof inet_addr);
+        inet_addr.sin_family = AF_INET;
+        inet_addr.sin_port = htons(atoi(address));
+        inet_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+            perror("socket");
+            return -1;
         }
-        
-        client->wrote += count;
+
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int));
+        setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &(int){1}, sizeof(int));
+
+        status = bind(fd, (struct sockaddr *) &inet_addr, sizeof inet_addr);
     }
 
-    if (client->wrote == len) {
-        client->needs_metadata = 0;
+    if (status == -1) {
+        perror("bind");
+        close(fd);
+        return -1;
     }
-    
-    if (closing) {
-        client_close(client, clients, efd);
+
+    status = listen(fd, METRICSBACKLOG);
+    if (status == -1) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int metrics_accept(struct handle *handle,
+                          uint32_t events __attribute__((unused)))
+{
+    struct server *server = container_of(handle, struct server, metrics);
+    struct scraper *scraper;
+    int fd, i, status;
+
+    while ((fd = accept4(handle->fd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+    {
+        scraper = NULL;
+        for (i = 0; i < SCRAPERS && scraper == NULL; i++)
+            if (server->scrapers[i].handle.fd == -1)
+                scraper = &server->scrapers[i];
+
+        if (scraper == NULL) {
+            log_print(LOG_WARN, "metrics: too many scrapers, refusing new "
+                      "connection");
+            close(fd);
+            continue;
+        }
+
+        scraper->handle.fd = fd;
+
+        status = shard_watch(&server->shards[0], &scraper->handle,
+                             EPOLLIN | EPOLLONESHOT);
+        if (status == -1) return -1;
     }
 
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED)
+        log_print(LOG_WARN, "metrics: accept: %s", strerror(errno));
+
     return 0;
 }
 
-static int client_close(struct client *client, slab_t *clients, int efd) {
-    int status;
+static int metrics_read(struct handle *handle,
+                        uint32_t events __attribute__((unused)))
+{
+    struct scraper *scraper = container_of(handle, struct scraper, handle);
+    struct server *server = scraper->server;
+    char request[1024];
+    size_t len;
+    ssize_t count;
+    int header;
 
-    printf("closed %d fd\n", client->fd);
+    count = recv(handle->fd, request, sizeof request, MSG_DONTWAIT);
+    if (count > 0) {
+        while (recv(handle->fd, request, sizeof request, MSG_DONTWAIT) > 0);
 
-    shutdown(client->fd, SHUT_RDWR);
+        len = metrics_render(server->scrape + SCRAPEHEADER,
+                             METRICSBUFFER - SCRAPEHEADER);
 
-    status = epoll_ctl(efd, EPOLL_CTL_DEL, client->fd, NULL);
-    if (status == -1) {
-        perror("epoll_ctl");
-        return -1;
+        header = snprintf(request, sizeof request, "HTTP/1.0 200 OK\r\n"
+                          "Content-Type: text/plain; version=0.0.4\r\n"
+                          "Content-Length: %zu\r\n\r\n", len);
+        memcpy(server->scrape + SCRAPEHEADER - header, request, header);
+        len += header;
+
+        setsockopt(handle->fd, SOL_SOCKET, SO_SNDBUF, &(int){METRICSBUFFER},
+                   sizeof(int));
+
+        count = send(handle->fd, server->scrape + SCRAPEHEADER - header, len,
+                     MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (count != (ssize_t) len)
+            log_print(LOG_WARN, "metrics: short scrape write");
+
+        shutdown(handle->fd, SHUT_WR);
     }
 
-    slab_remove(clients, client->index);
+    close(handle->fd);
+    handle->fd = -1;
+
     return 0;
 }
 
-static int load_playlist(char *dir_path, char ***out) {
-    struct dirent *dir;
-    size_t dir_path_len = strlen(dir_path);
-    char *dot;
-    DIR *d;
-    int n = 0, i = 0;
+static int create_upgrade(void) {
+    sigset_t set;
+    int fd;
 
-    d = opendir(dir_path);
-    if (d == NULL) {
-        perror("opendir");
-        return -1;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR2);
+
+    fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd == -1) perror("signalfd");
+
+    return fd;
+}
+
+static int upgrade_read(struct handle *handle,
+                        uint32_t events __attribute__((unused)))
+{
+    struct server *server = container_of(handle, struct server, upgrade);
+    struct signalfd_siginfo info;
+
+    while (read(handle->fd, &info, sizeof info) == sizeof info);
+
+    if (server->handoff.fd != -1) {
+        log_print(LOG_WARN, "upgrade: already in progress");
+        return 0;
+    }
+
+    if (server->shards[0].config.backend == BACKEND_URING) {
+        log_print(LOG_WARN, "upgrade: not supported with the uring backend");
+        return 0;
     }
 
-    while ((dir = readdir(d)) != NULL) {
-        if (dir->d_type != DT_REG) continue;
-        dot = strrchr(dir->d_name, '.');
-        if (!dot || strcmp(dot, ".rip")) continue;
-        n++; 
+    if (server->relays_len > 0) {
+        log_print(LOG_WARN, "upgrade: not supported in relay mode");
+        return 0;
     }
 
-    closedir(d);
+    return upgrade_start(server);
+}
 
-    if (n == 0) {
-        fprintf(stderr, "empty playlist");
-        return -1;
+static int upgrade_start(struct server *server) {
+    size_t len = strlen(HANDOFFENV);
+    char variable[32], **env;
+    int fds[2], i, n, status;
+    pid_t pid;
+
+    status = socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds);
+    if (status == -1) {
+        perror("socketpair");
+        return 0;
     }
 
-    d = opendir(dir_path);
-    if (d == NULL) {
-        perror("opendir");
-        return -1;
+    for (n = 0; environ[n] != NULL; n++);
+
+    env = (char **) malloc((n + 2) * sizeof(char *));
+    if (env == NULL) {
+        close(fds[0]);
+        close(fds[1]);
+        return 0;
     }
 
-    *out = (char **) malloc(n * sizeof(char *));
-    if (*out == NULL) return -1;
+    for (i = n = 0; environ[i] != NULL; i++)
+        if (strncmp(environ[i], HANDOFFENV "=", len + 1) != 0)
+            env[n++] = environ[i];
 
-    while ((dir = readdir(d)) != NULL) {
-        if (dir->d_type != DT_REG) continue;
-        dot = strrchr(dir->d_name, '.');
-        if (!dot || strcmp(dot, ".rip")) continue;
+    snprintf(variable, sizeof variable, "%s=%d", HANDOFFENV, fds[1]);
+    env[n++] = variable;
+    env[n] = NULL;
 
-        (*out)[i] = (char *) malloc(strlen(dir->d_name) + dir_path_len + 2);
-        if ((*out)[i] == NULL) return -1;
-        
-        memcpy((*out)[i], dir_path, dir_path_len);
-        (*out)[i][dir_path_len] = '/';
-        memcpy((*out)[i] + dir_path_len + 1, dir->d_name,
-               strlen(dir->d_name) + 1);
+    pid = fork();
+    if (pid == 0) {
+        fcntl(fds[1], F_SETFD, 0);
+        execvpe(server->argv[0], server->argv, env);
+        _exit(127);
+    }
 
-        i++;
+    free(env);
+    close(fds[1]);
+
+    if (pid == -1) {
+        perror("fork");
+        close(fds[0]);
+        return 0;
     }
 
-    closedir(d);
+    server->child = pid;
+    server->handoff.fd = fds[0];
+
+    log_print(LOG_INFO, "upgrade: started pid=%d", (int) pid);
 
-    return n;
+    return shard_watch(&server->shards[0], &server->handoff, EPOLLIN);
 }
 
-static int load_song(char *song_path, struct rip_metadata *metadata,
-                     char **metadata_out, size_t *metadata_out_len,
-                     uint32_t *time, FILE **rip_file)
-{
-    int status;
+static void upgrade_abort(struct server *server) {
+    close(server->handoff.fd);
+    server->handoff.fd = -1;
 
-    if (*rip_file != NULL)
-        fclose(*rip_file);
+    kill(server->child, SIGKILL);
+    waitpid(server->child, NULL, 0);
+    server->child = 0;
+}
 
-    *rip_file = fopen(song_path, "rb");
-    if (rip_file == NULL) {
-        perror("fopen");
-        return -1;
+static int handoff_ready(struct handle *handle,
+                         uint32_t events __attribute__((unused)))
+{
+    struct server *server = container_of(handle, struct server, handoff);
+    int i, status;
+
+    if (handoff_recv(handle->fd, HANDOFF_READY, NULL, 0, NULL) == -1) {
+        log_print(LOG_ERROR, "upgrade: pid=%d failed to start",
+                  (int) server->child);
+        upgrade_abort(server);
+        return 0;
     }
 
-    status = rip_parse_metadata(*rip_file, metadata);
+    status = timer_read(&server->timer, EPOLLIN);
     if (status == -1) return -1;
-    
-    printf("current song: ");
-    rip_print_metadata(metadata);
-    printf("\n");
 
-    *metadata_out_len = rip_encode_metadata(metadata, metadata_out);
-    if (*metadata_out_len == (size_t) -1) return -1;
+    for (i = 1; i < server->shards_len; i++) {
+        shard_stop(&server->shards[i]);
+        pthread_join(server->shards[i].thread, NULL);
+    }
+
+    status = handoff_export(server, handle->fd);
+    if (status == 0)
+        status = handoff_recv(handle->fd, HANDOFF_DONE, NULL, 0, NULL);
+
+    if (status == -1) {
+        log_print(LOG_ERROR, "upgrade: handoff to pid=%d failed, resuming",
+                  (int) server->child);
+        upgrade_abort(server);
+
+        for (i = 1; i < server->shards_len; i++) {
+            __atomic_store_n(&server->shards[i].running, 1,
+                             __ATOMIC_RELEASE);
 
-    *time = 0;
+            status = shard_start(&server->shards[i]);
+            if (status == -1) return -1;
+        }
+
+        return 0;
+    }
+
+    log_print(LOG_INFO, "upgrade: handed over to pid=%d",
+              (int) server->child);
+
+    server->upgraded = 1;
+    shard_stop(&server->shards[0]);
 
     return 0;
 }
 
-static volatile int running = 1;
+static int handoff_export(struct server *server, int sock) {
+    struct handoff_server header;
+    struct handoff_station station;
+    int i, status;
+
+    memset(&header, 0, sizeof header);
+    header.shards = server->shards_len;
+    header.stations = server->stations_len;
+    header.tick = server->pacer.last;
+
+    status = handoff_send(sock, HANDOFF_SERVER, &header, sizeof header,
+                          server->metrics.fd);
+    if (status == -1) return -1;
+
+    for (i = 0; i < server->stations_len; i++) {
+        memset(&station, 0, sizeof station);
+        station.song = server->stations[i].current_song;
+        station.offset = server->stations[i].offset;
+        station.debt = server->stations[i].debt;
+
+        status = handoff_send(sock, HANDOFF_STATION, &station,
+                              sizeof station, -1);
+        if (status == -1) return -1;
+    }
+
+    for (i = 0; i < server->shards_len; i++) {
+        status = shard_export(&server->shards[i], sock);
+        if (status == -1) return -1;
+    }
+
+    return handoff_send(sock, HANDOFF_DONE, NULL, 0, -1);
+}
+
+static int handoff_receive(struct server *server, int sock,
+                           const struct shard_config *config,
+                           const char **names, int *metrics_fd)
+{
+    struct handoff_server header;
+    struct handoff_station station;
+    struct handoff_listener listener;
+    struct handoff_client client;
+    struct packet *backlog;
+    uint64_t received;
+    ssize_t count;
+    uint32_t j;
+    int i, k, fd, status;
+
+    status = handoff_send(sock, HANDOFF_READY, NULL, 0, -1);
+    if (status == -1) return -1;
+
+    count = handoff_recv(sock, HANDOFF_SERVER, &header, sizeof header,
+                         metrics_fd);
+    if (count != sizeof header) return -1;
+
+    if (header.shards != (uint32_t) server->shards_len
+        || header.stations != (uint32_t) server->stations_len)
+    {
+        fprintf(stderr, "handoff: got %u shards and %u stations, "
+                "expected %d and %d\n", header.shards, header.stations,
+                server->shards_len, server->stations_len);
+        return -1;
+    }
+
+    server->pacer.last = header.tick;
+
+    for (i = 0; i < server->stations_len; i++) {
+        count = handoff_recv(sock, HANDOFF_STATION, &station, sizeof station,
+                             NULL);
+        if (count != sizeof station) return -1;
+
+        status = station_seek(&server->stations[i], station.song,
+                              station.offset);
+        if (status == -1) {
+            fprintf(stderr, "handoff: cannot resume station %s\n",
+                    server->stations[i].name);
+            return -1;
+        }
+
+        server->stations[i].debt = station.debt;
+    }
+
+    for (i = 0; i < server->shards_len; i++) {
+        count = handoff_recv(sock, HANDOFF_LISTENER, &listener,
+                             sizeof listener, &fd);
+        if (count != sizeof listener || fd == -1) return -1;
+
+        status = shard_new(&server->shards[i], i, fd, config, names,
+                           server->stations_len);
+        if (status == -1) return -1;
+
+        for (k = 0; k < server->stations_len; k++)
+            shard_resume(&server->shards[i], k,
+                         server->stations[k].track->metadata_packet);
+
+        for (j = 0; j < listener.clients; j++) {
+            count = handoff_recv(sock, HANDOFF_CLIENT, &client,
+                                 sizeof client, &fd);
+            if (count != sizeof client || fd == -1) return -1;
+
+            backlog = NULL;
+            if (client.backlog > 0) {
+                backlog = packet_new(client.backlog);
+                if (backlog == NULL) return -1;
+
+                for (received = 0; received < client.backlog;
+                     received += count)
+                {
+                    count = handoff_recv(sock, HANDOFF_BACKLOG,
+                                         backlog->data + received,
+                                         client.backlog - received, NULL);
+                    if (count <= 0) {
+                        packet_unref(backlog);
+                        return -1;
+                    }
+                }
+            }
+
+            status = shard_adopt(&server->shards[i], fd, &client, backlog);
+            if (status == -1) return -1;
+        }
+
+        log_print(LOG_INFO, "resumed listener fd=%d shard=%d clients=%u",
+                  server->shards[i].listener.fd, i, listener.clients);
+    }
+
+    if (handoff_recv(sock, HANDOFF_DONE, NULL, 0, NULL) == -1) return -1;
+
+    return handoff_send(sock, HANDOFF_DONE, NULL, 0, -1);
+}
 
 void intHandler(int sig __attribute__((unused))) {
-    running = 0;
     printf("\ninterrupted");
 }
 
-const char* const USAGE = "usage: %s <port> <playlist>\n";
+const char* const USAGE =
+    "usage: %s [-j threads] [-b epoll|uring] [-z] [-t tick ms] "
+    "[-B burst ms] [-M cache MiB] [-P drop|skip|shrink] [-L lag ticks] "
+    "[-D defer s] [-I max per ip] [-l debug|info|warn|error] "
+    "[-m metrics port|path] [-u upstream host:port] "
+    "<port> <playlist|station>...\n";
 
 int main(int argc, char *argv[]) {
-    int status, sfd, efd, timerfd;
-    struct epoll_event event;
-    struct epoll_event *events;
-    struct rip_metadata metadata;
-    slab_t clients;
-    FILE *rip_file;
-
-    char *metadata_out;
-    size_t metadata_out_len;
-
-    char chunk[8 * SAMPLESIZE * SAMPLERATE + 9] = {0};
-    size_t chunk_len = 0;
-    uint32_t time = 0;
-
-    char **playlist = NULL;
-    int current_song = 0;
-    int playlist_size;
+    int status, opt, sfd, i, threads = 1, burst = BURST, lag = MAXLAG;
+    int defer = 0, per_ip = MAXPERIP;
+    enum log_level level = LOG_INFO;
+    const char *metrics = NULL, *upstream = NULL;
+    long budget = CACHEBUDGET;
+    struct shard_config config = {0};
+    struct server server = {0};
+    int handoff = -1, metrics_fd = -1;
+    const char **names;
+    uint64_t tick;
+    sigset_t set;
     
-    if (argc != 3) {
+    config.backend = BACKEND_EPOLL;
+    config.policy = POLICY_DROP;
+
+    server.pacer.interval = TICKINTERVAL;
+
+    while ((opt = getopt(argc, argv, "j:b:zt:B:M:P:L:D:I:l:m:u:")) != -1) {
+        switch (opt) {
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'b':
+            if (strcmp(optarg, "epoll") == 0) {
+                config.backend = BACKEND_EPOLL;
+            } else if (strcmp(optarg, "uring") == 0) {
+                config.backend = BACKEND_URING;
+            } else {
+                fprintf(stderr, USAGE, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'z':
+            config.zerocopy = 1;
+            break;
+        case 't':
+            server.pacer.interval = atoi(optarg);
+            break;
+        case 'B':
+            burst = atoi(optarg);
+            break;
+        case 'M':
+            budget = atol(optarg);
+            break;
+        case 'P':
+            if (strcmp(optarg, "drop") == 0) {
+                config.policy = POLICY_DROP;
+            } else if (strcmp(optarg, "skip") == 0) {
+                config.policy = POLICY_SKIP;
+            } else if (strcmp(optarg, "shrink") == 0) {
+                config.policy = POLICY_SHRINK;
+            } else {
+                fprintf(stderr, USAGE, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'L':
+            lag = atoi(optarg);
+            break;
+        case 'D':
+            defer = atoi(optarg);
+            break;
+        case 'I':
+            per_ip = atoi(optarg);
+            break;
+        case 'm':
+            metrics = optarg;
+            break;
+        case 'u':
+            upstream = optarg;
+            break;
+        case 'l':
+            if (log_parse_level(optarg, &level) == -1) {
+                fprintf(stderr, USAGE, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (argc - optind < 2 || threads < 1 || server.pacer.interval < 1
+        || burst < 0 || budget < 0 || lag < 2 || lag >= RINGSIZE
+        || defer < 0 || per_ip < 0)
+    {
         fprintf(stderr, USAGE, argv[0]);
         exit(EXIT_FAILURE);
     }
 
+    if (upstream != NULL && config.backend != BACKEND_EPOLL) {
+        fprintf(stderr, "relay mode needs the epoll backend\n");
+        exit(EXIT_FAILURE);
+    }
+
+    config.lag = lag;
+    config.burst = burst / server.pacer.interval;
+    if (config.burst > config.lag / 2)
+        config.burst = config.lag / 2;
+
+    config.per_ip = per_ip;
+    config.ip_counts = (uint32_t *) calloc(IPSLOTS, sizeof(uint32_t));
+    if (config.ip_counts == NULL) exit(EXIT_FAILURE);
+
+    if (getenv(HANDOFFENV) != NULL) {
+        handoff = atoi(getenv(HANDOFFENV));
+        unsetenv(HANDOFFENV);
+    }
+
+    server.argv = argv;
+    server.handoff.fd = -1;
+    server.handoff.handler = handoff_ready;
+
     signal(SIGINT, intHandler);
+    signal(SIGPIPE, SIG_IGN);
 
-    status = slab_new(&clients, MAXCLIENTS, sizeof(struct client));
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR2);
+    sigprocmask(SIG_BLOCK, &set, NULL);
+
+    status = log_start(level);
     if (status == -1) exit(EXIT_FAILURE);
 
-    playlist_size = load_playlist(argv[2], &playlist);
-    if (playlist_size == -1) exit(EXIT_FAILURE);
+    status = log_attach("main");
+    if (status == -1) exit(EXIT_FAILURE);
 
-    printf("playlist loaded (%d songs)\n", playlist_size);
+    status = cache_new(&server.cache, (size_t) budget << 20,
+                       server.pacer.interval);
+    if (status == -1) exit(EXIT_FAILURE);
 
-    status = load_song(playlist[current_song], &metadata, &metadata_out,
-                       &metadata_out_len, &time, &rip_file);
+    status = loader_new(&server.loader, &server.cache);
     if (status == -1) exit(EXIT_FAILURE);
 
-    sfd = bind_listener(argv[1]);
-    if (sfd == -1) exit(EXIT_FAILURE);
-    
-    timerfd = create_timer();
-    if (timerfd == -1) exit(EXIT_FAILURE);
+    names = (const char **) calloc(argc - optind - 1, sizeof(char *));
+    if (names == NULL) exit(EXIT_FAILURE);
 
-    status = set_nonblock(sfd);
-    if (status == -1) exit(EXIT_FAILURE);
+    if (upstream != NULL) {
+        status = resolve_upstream(upstream, &server.upstream,
+                                  &server.upstream_len);
+        if (status == -1) exit(EXIT_FAILURE);
 
-    status = listen(sfd, SOMAXCONN);
-    if (status == -1) {
-        perror("listen");
-        exit(EXIT_FAILURE);
+        server.relays_len = argc - optind - 1;
+        server.relays = (struct relay *) calloc(server.relays_len,
+                                                sizeof(struct relay));
+        if (server.relays == NULL) exit(EXIT_FAILURE);
+    } else {
+        server.stations_len = argc - optind - 1;
     }
 
-    efd = epoll_create1(0);
-    if (efd == -1) {
-        perror("epoll_create");
+    server.stations = (struct station *) calloc(server.stations_len,
+                                                sizeof(struct station));
+    if (server.stations == NULL && server.stations_len > 0)
         exit(EXIT_FAILURE);
+
+    for (i = 0; i < server.relays_len; i++) {
+        status = relay_new(&server.relays[i], i, argv[optind + 1 + i],
+                           (struct sockaddr *) &server.upstream,
+                           server.upstream_len, &server);
+        if (status == -1) exit(EXIT_FAILURE);
+
+        server.relays[i].handle.handler = relay_event;
+        names[i] = server.relays[i].name;
     }
 
-    event.data.fd = sfd;
-    event.events = EPOLLIN | EPOLLET;
-    
-    status = epoll_ctl(efd, EPOLL_CTL_ADD, sfd, &event);
-    if (status == -1) {
-        perror("epoll_ctl");
-        exit(EXIT_FAILURE);
+    for (i = 0; i < server.stations_len; i++) {
+        status = station_new(&server.stations[i], i, argv[optind + 1 + i],
+                             &server.loader);
+        if (status == -1) exit(EXIT_FAILURE);
+
+        names[i] = server.stations[i].name;
     }
 
-    event.data.fd = timerfd;
-    event.events = EPOLLIN;
+    server.shards = (struct shard *) calloc(threads, sizeof(struct shard));
+    if (server.shards == NULL) exit(EXIT_FAILURE);
+    server.shards_len = threads;
 
-    status = epoll_ctl(efd, EPOLL_CTL_ADD, timerfd, &event);
-    if (status == -1) {
-        perror("epoll_ctl");
-        exit(EXIT_FAILURE);
+    if (handoff != -1) {
+        status = handoff_receive(&server, handoff, &config, names,
+                                 &metrics_fd);
+        if (status == -1) exit(EXIT_FAILURE);
+        close(handoff);
+    } else {
+        for (i = 0; i < threads; i++) {
+            sfd = bind_listener(argv[optind], threads > 1, defer);
+            if (sfd == -1) exit(EXIT_FAILURE);
+
+            status = shard_new(&server.shards[i], i, sfd, &config, names,
+                               server.stations_len + server.relays_len);
+            if (status == -1) exit(EXIT_FAILURE);
+
+            log_print(LOG_INFO, "listening on port %s fd=%d shard=%d",
+                      argv[optind], sfd, i);
+        }
+
+        for (i = 0; i < server.stations_len; i++)
+            server_publish(&server, i,
+                           server.stations[i].track->metadata_packet);
     }
 
-    events = (struct epoll_event *) calloc(MAXEVENTS, sizeof event);
+    status = server_notify(&server);
+    if (status == -1) exit(EXIT_FAILURE);
 
-    printf("listening on %s port %d fd\n", argv[1], sfd);
+    server.timer.fd = create_timer(server.pacer.interval, &tick);
+    if (server.timer.fd == -1) exit(EXIT_FAILURE);
+    server.timer.handler = timer_read;
 
-    while (running) {
-        int n = epoll_wait(efd, events, MAXEVENTS, -1);
+    if (handoff != -1 && tick > server.pacer.last) {
+        status = server_tick(&server, tick - server.pacer.last);
+        if (status == -1) exit(EXIT_FAILURE);
+    }
+    server.pacer.last = tick;
 
-        if (n == -1) break;
+    status = shard_watch(&server.shards[0], &server.timer, EPOLLIN);
+    if (status == -1) exit(EXIT_FAILURE);
 
-        for (int i = 0; i < n; i++) {
-            struct client *client = (struct client *) events[i].data.ptr;
+    server.watcher.fd = create_watcher(&server);
+    if (server.watcher.fd == -1) exit(EXIT_FAILURE);
+    server.watcher.handler = watcher_read;
 
-            if (events[i].data.fd == sfd) {
-                status = listener_accept(sfd, efd, &clients);
-                if (status == -1) exit(EXIT_FAILURE);
+    status = shard_watch(&server.shards[0], &server.watcher, EPOLLIN);
+    if (status == -1) exit(EXIT_FAILURE);
 
-            } else if (events[i].data.fd == timerfd) {
-                status = timer_read(timerfd, efd, &clients, chunk, &chunk_len,
-                                    &rip_file, playlist, &current_song,
-                                    playlist_size, &metadata, &metadata_out,
-                                    &metadata_out_len, &time);
+    server.upgrade.fd = create_upgrade();
+    if (server.upgrade.fd == -1) exit(EXIT_FAILURE);
+    server.upgrade.handler = upgrade_read;
 
-                if (status == -1) exit(EXIT_FAILURE);
+    status = shard_watch(&server.shards[0], &server.upgrade, EPOLLIN);
+    if (status == -1) exit(EXIT_FAILURE);
 
-            } else if (events[i].events & EPOLLIN) {
-                status = client_read(client, &clients, efd);
-                if (status == -1) exit(EXIT_FAILURE);
+    for (i = 0; i < server.relays_len; i++) {
+        status = relay_start(&server, &server.relays[i]);
+        if (status == -1) exit(EXIT_FAILURE);
+    }
 
-            } else if (events[i].events & EPOLLOUT) {
-                if (client->needs_metadata)
-                    status = client_write(client, metadata_out,
-                                          metadata_out_len,
-                                          &clients, efd);
-                else
-                    status = client_write(client, chunk, chunk_len,
-                                          &clients, efd);
-                if (status == -1) exit(EXIT_FAILURE);
+    server.metrics.fd = -1;
+    for (i = 0; i < SCRAPERS; i++) {
+        server.scrapers[i].handle.fd = -1;
+        server.scrapers[i].handle.handler = metrics_read;
+        server.scrapers[i].server = &server;
+    }
 
-            } else if (events[i].events & EPOLLHUP
-                       || events[i].events & EPOLLERR)
-            {
-                status = client_close(client, &clients, efd);
-                if (status == -1) exit(EXIT_FAILURE);
-            }
+    if (metrics != NULL) {
+        server.scrape = (char *) malloc(METRICSBUFFER);
+        if (server.scrape == NULL) exit(EXIT_FAILURE);
+
+        server.metrics.fd = metrics_fd != -1 ? metrics_fd
+            : create_metrics(metrics);
+        if (server.metrics.fd == -1) exit(EXIT_FAILURE);
+        server.metrics.handler = metrics_accept;
+
+        status = shard_watch(&server.shards[0], &server.metrics, EPOLLIN);
+        if (status == -1) exit(EXIT_FAILURE);
+
+        log_print(LOG_INFO, "metrics on %s fd=%d", metrics,
+                  server.metrics.fd);
+    } else if (metrics_fd != -1) {
+        close(metrics_fd);
+    }
+
+    for (i = 1; i < threads; i++) {
+        status = shard_start(&server.shards[i]);
+        if (status == -1) exit(EXIT_FAILURE);
+    }
+
+    status = shard_run(&server.shards[0]);
+
+    if (!server.upgraded) {
+        for (i = 1; i < threads; i++) {
+            shard_stop(&server.shards[i]);
+            pthread_join(server.shards[i].thread, NULL);
         }
+
+        for (i = 0; i < threads; i++)
+            shard_free(&server.shards[i]);
+
+        if (server.handoff.fd != -1) upgrade_abort(&server);
+    } else {
+        close(server.handoff.fd);
     }
 
-    free(events);
-    rip_free_metadata(&metadata);
-    close(sfd);
-    fclose(rip_file);
+    free(server.shards);
+    close(server.timer.fd);
+    close(server.watcher.fd);
+    close(server.upgrade.fd);
+    if (server.metrics.fd != -1) close(server.metrics.fd);
+    for (i = 0; i < SCRAPERS; i++)
+        if (server.scrapers[i].handle.fd != -1)
+            close(server.scrapers[i].handle.fd);
+    free(server.scrape);
 
-    return EXIT_SUCCESS;
-}
+    loader_free(&server.loader);
+
+    for (i = 0; i < server.stations_len; i++)
+        station_free(&server.stations[i]);
+
+    for (i = 0; i < server.relays_len; i++)
+        relay_free(&server.relays[i]);
 
+    cache_free(&server.cache);
+
+    free(server.stations);
+    free(server.relays);
+    free(names);
+    free(config.ip_counts);
+
+    log_stop();
+
+    return status == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -3,51 +3,94 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <sys/types.h>
 
-#include "slab.h"
 #include "rip.h"
+#include "packet.h"
+#include "shard.h"
+#include "station.h"
+#include "loader.h"
+#include "cache.h"
+#include "metrics.h"
+#include "handoff.h"
+#include "relay.h"
 
-#define MAXEVENTS 64
-#define MAXCLIENTS 64
+#define TICKINTERVAL 250
+#define MAXCATCHUP 16
+#define BURST 2000
+#define SCRAPEHEADER 128
+#define SCRAPERS 4
 
-#ifndef NI_MAXHOST
-#define NI_MAXHOST 1025
-#endif
+struct pacer {
+    unsigned int interval;
+    uint64_t ticks;
+    uint64_t last;
+};
 
-#ifndef NI_MAXSERV
-#define NI_MAXSERV 32
-#endif
+static int bind_listener(const char *service, int reuseport, int defer);
+static int create_timer(unsigned int interval, uint64_t *tick);
 
-static int bind_listener(const char *service);
-static int set_nonblock(int sfd);
-static int create_timer(void);
+#define WATCHMASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE \
+                   | IN_DELETE_SELF)
 
-struct client {
-    int fd;
-    unsigned int initialized: 1;
-    unsigned int needs_metadata: 1;
-    size_t wrote;
-    size_t index;
+struct scraper {
+    struct handle handle;
+    struct server *server;
 };
 
-static int listener_accept(int sfd, int efd, slab_t *clients);
-static int timer_read(int timerfd, int efd, slab_t *clients,
-                      char *chunk, size_t *chunk_len, FILE **rip_file,
-                      char **playlist, int *current_song, int playlist_size,
-                      struct rip_metadata *metadata, char **metadata_out,
-                      size_t *metadata_out_len, uint32_t *rip_time);
+struct server {
+    struct handle timer;
+    struct handle watcher;
+    struct handle metrics;
+    struct scraper scrapers[SCRAPERS];
+    char *scrape;
+    struct pacer pacer;
+    struct cache cache;
+    struct loader loader;
+    struct station *stations;
+    int stations_len;
 
-static int client_read(struct client *event, slab_t *clients, int efd);
-static int client_write(struct client *event, const char *buf, size_t len,
-                        slab_t *clients, int efd);
-static int client_close(struct client *client, slab_t *clients, int efd);
+    struct shard *shards;
+    int shards_len;
 
-static int load_playlist(char *dir_path, char ***out);
-static int load_song(char *song_path, struct rip_metadata *metadata,
-                     char **metadata_out, size_t *metadata_out_len,
-                     uint32_t *time, FILE **rip_file);
+    struct relay *relays;
+    int relays_len;
+    struct sockaddr_storage upstream;
+    socklen_t upstream_len;
+
+    struct handle upgrade;
+    struct handle handoff;
+    pid_t child;
+    char **argv;
+    int upgraded;
+};
+
+static int server_publish(struct server *server, int station,
+                          struct packet *packet);
+static int server_notify(struct server *server);
+static int server_tick(struct server *server, uint64_t expirations);
+static int timer_read(struct handle *handle, uint32_t events);
+static int create_watcher(struct server *server);
+static int watcher_read(struct handle *handle, uint32_t events);
+static int create_metrics(const char *address);
+static int metrics_accept(struct handle *handle, uint32_t events);
+static int metrics_read(struct handle *handle, uint32_t events);
+static int resolve_upstream(const char *address,
+                            struct sockaddr_storage *addr, socklen_t *len);
+static int relay_start(struct server *server, struct relay *relay);
+static int relay_lost(struct server *server, struct relay *relay);
+static int relay_event(struct handle *handle, uint32_t events);
+static int server_reconnect(struct server *server);
+static int create_upgrade(void);
+static int upgrade_read(struct handle *handle, uint32_t events);
+static int upgrade_start(struct server *server);
+static void upgrade_abort(struct server *server);
+static int handoff_ready(struct handle *handle, uint32_t events);
+static int handoff_export(struct server *server, int sock);
+static int handoff_receive(struct server *server, int sock,
+                           const struct shard_config *config,
+                           const char **names, int *metrics_fd);
 
 void intHandler(int sig);
 
 #endif
-
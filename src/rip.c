@@ -1,167 +1,332 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <byteswap.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "rip.h"
+#include "log.h"
 
 #define IS_LITTLE_ENDIAN (1 == *(unsigned char *)&(const int){1})
 
-int rip_parse_string(FILE *f, char **out) {
-    int count;
-    uint16_t len;
+static uint16_t read_u16(const char *buf) {
+    uint16_t value;
 
-    count = fread(&len, 1, 2, f);
-    if (count != 2) {
-        if (errno != 0)
-            perror("rip_parse");
-        else
-            fprintf(stderr, "rip_parse_metadata: unexpected EOF\n");
-        return -1;
-    }
+    memcpy(&value, buf, 2);
+    if (IS_LITTLE_ENDIAN)
+        value = __bswap_16(value);
+
+    return value;
+}
+
+static uint32_t read_u32(const char *buf) {
+    uint32_t value;
 
+    memcpy(&value, buf, 4);
     if (IS_LITTLE_ENDIAN)
-        len = __bswap_16(len); 
+        value = __bswap_32(value);
 
-    *out = (char *) calloc(len + 1, 1);
+    return value;
+}
 
-    count = fread(*out, 1, len, f);
-    if (count != len) {
-        if (errno != 0)
-            perror("rip_parse");
-        else
-            fprintf(stderr, "rip_parse_metadata: unexpected EOF\n");
-        return -1;
-    }
+static void write_u32(char *buf, uint32_t value) {
+    if (IS_LITTLE_ENDIAN)
+        value = __bswap_32(value);
 
-    return 0;
+    memcpy(buf, &value, 4);
 }
 
-int rip_parse_metadata(FILE *f, struct rip_metadata *metadata) {
-    int status, count;
-    char signature[4];
-    signature[3] = 0;
+static int parse_string(const char *buf, size_t len, size_t *offset,
+                        struct rip_string *out)
+{
+    if (len - *offset < 2) {
+        log_print(LOG_ERROR, "rip_parse: unexpected EOF");
+        return -1;
+    }
 
-    count = fread(signature, 1, 3, f);
-    if (count != 3) {
-        if (errno != 0)
-            perror("rip_parse");
-        else
-            fprintf(stderr, "rip_parse_metadata: unexpected EOF\n");
+    out->len = read_u16(buf + *offset);
+    *offset += 2;
+
+    if (len - *offset < out->len) {
+        log_print(LOG_ERROR, "rip_parse: unexpected EOF");
         return -1;
     }
 
-    if (strcmp(signature, "rip") != 0) {
-        fprintf(stderr, "rip_parse_metadata: bad signature\n");
+    out->data = buf + *offset;
+    *offset += out->len;
+
+    return 0;
+}
+
+int rip_parse_metadata(const char *buf, size_t len,
+                       struct rip_metadata *metadata)
+{
+    int status;
+    size_t offset = 3;
+
+    if (len < 3 || memcmp(buf, "rip", 3) != 0) {
+        log_print(LOG_ERROR, "rip_parse_metadata: bad signature");
         return -1;
     }
 
-    status = rip_parse_string(f, &metadata->name);
+    status = parse_string(buf, len, &offset, &metadata->name);
     if (status == -1) return -1;
 
-    status = rip_parse_string(f, &metadata->artist);
+    status = parse_string(buf, len, &offset, &metadata->artist);
     if (status == -1) return -1;
 
-    status = rip_parse_string(f, &metadata->album);
+    status = parse_string(buf, len, &offset, &metadata->album);
     if (status == -1) return -1;
 
-    count = fread(&metadata->length, 1, 4, f);
-    if (count == 0) {
-        fprintf(stderr, "rip_parse_metadata: unexpected EOF\n");
-        return -1;
-    } else if (count != 4) {
-        if (errno != 0)
-            perror("rip_parse_metadata");
-        else
-            fprintf(stderr, "rip_parse_metadata: unexpected EOF\n");
+    if (len - offset < 4) {
+        log_print(LOG_ERROR, "rip_parse_metadata: unexpected EOF");
         return -1;
     }
 
-    if (IS_LITTLE_ENDIAN)
-        metadata->length = __bswap_32(metadata->length);
+    metadata->size = read_u32(buf + offset);
+    offset += 4;
+
+    if (metadata->size > len - offset)
+        metadata->size = len - offset;
 
-    metadata->length = metadata->length * 8 / SAMPLESIZE / SAMPLERATE * 100;
+    metadata->length = BYTES_TO_CS(metadata->size);
+    metadata->data = buf + offset;
 
     return 0;
 }
 
-size_t rip_encode_metadata(const struct rip_metadata *metadata,
-                           char **out)
+int rip_decode_metadata(const char *buf, size_t len,
+                        struct rip_metadata *metadata)
 {
-    size_t name_lens, artist_lens, album_lens;
+    int status;
+    size_t offset = 5;
 
-    size_t name_len = strlen(metadata->name),
-           artist_len = strlen(metadata->artist),
-           album_len = strlen(metadata->album);
+    if (len < 5 || buf[0] != 1) {
+        log_print(LOG_ERROR, "rip_decode_metadata: bad packet");
+        return -1;
+    }
+
+    metadata->length = read_u32(buf + 1);
 
-    size_t len = 11 + name_len + artist_len + album_len;
+    status = parse_string(buf, len, &offset, &metadata->name);
+    if (status == -1) return -1;
+
+    status = parse_string(buf, len, &offset, &metadata->artist);
+    if (status == -1) return -1;
 
-    if (IS_LITTLE_ENDIAN) {
-        name_lens = __bswap_16(name_len);
-        artist_lens = __bswap_16(artist_len);
-        album_lens = __bswap_16(album_len);
-    } else {
-        name_lens = name_len;
-        artist_lens = artist_len;
-        album_lens = album_len;
+    status = parse_string(buf, len, &offset, &metadata->album);
+    if (status == -1) return -1;
+
+    if (offset != len) {
+        log_print(LOG_ERROR, "rip_decode_metadata: trailing bytes");
+        return -1;
     }
 
-    *out = (char *) malloc(len);
-    if (out == NULL) return -1;
+    return 0;
+}
+
+size_t rip_metadata_size(const struct rip_metadata *metadata) {
+    return 11 + metadata->name.len + metadata->artist.len
+        + metadata->album.len;
+}
+
+static char *encode_string(char *out, const struct rip_string *string) {
+    uint16_t len = string->len;
 
-    *out[0] = 1;
-    
-    memcpy(*out + 1, &metadata->length, 4);
     if (IS_LITTLE_ENDIAN)
-        *(uint32_t *) (*out + 1) = __bswap_32(*(uint32_t *) (*out + 1));
+        len = __bswap_16(len);
+
+    memcpy(out, &len, 2);
+    memcpy(out + 2, string->data, string->len);
+
+    return out + 2 + string->len;
+}
 
-    memcpy(*out + 5, &name_lens, 2);
-    memcpy(*out + 7, metadata->name, name_len);
+size_t rip_encode_metadata(const struct rip_metadata *metadata, char *out) {
+    char *end;
 
-    memcpy(*out + 7 + name_len, &artist_lens, 2);
-    memcpy(*out + 9 + name_len, metadata->artist, artist_len);
+    out[0] = 1;
+    write_u32(out + 1, metadata->length);
 
-    memcpy(*out + 9 + name_len + artist_len, &album_lens, 2);
-    memcpy(*out + 11 + name_len + artist_len, metadata->album, album_len);
+    end = encode_string(out + 5, &metadata->name);
+    end = encode_string(end, &metadata->artist);
+    end = encode_string(end, &metadata->album);
 
-    return len;
+    return end - out;
 }
 
-void rip_print_metadata(struct rip_metadata *metadata) {
-    printf("%s (%s) - %s [%u cs]", metadata->artist, metadata->album,
-            metadata->name, metadata->length);
+void rip_print_metadata(const struct rip_metadata *metadata) {
+    printf("%.*s (%.*s) - %.*s [%u cs]",
+           metadata->artist.len, metadata->artist.data,
+           metadata->album.len, metadata->album.data,
+           metadata->name.len, metadata->name.data, metadata->length);
 }
 
-void rip_free_metadata(struct rip_metadata *metadata) {
-    free(metadata->name);
-    free(metadata->artist);
-    free(metadata->album);
+void rip_encode_header(char *out, uint32_t len, uint64_t position) {
+    out[0] = 2;
+    write_u32(out + 1, len);
+    write_u32(out + 5, BYTES_TO_CS(position));
 }
 
-size_t rip_read_chunk(FILE *f, char *out, uint32_t *time) {
-    size_t count = fread(out + 9, 1, SAMPLESIZE * SAMPLERATE / 8, f);
+struct rip_map *rip_map_file(const char *path) {
+    struct rip_map *map;
+    struct stat st;
+    int fd, status;
 
-    if (count == 0) {
-        if (feof(f))
-            return 0;
-        else
-            perror("rip_read_chunk");
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("open");
+        return NULL;
+    }
+
+    status = fstat(fd, &st);
+    if (status == -1) {
+        perror("fstat");
+        close(fd);
+        return NULL;
+    }
+
+    if (st.st_size == 0) {
+        log_print(LOG_ERROR, "rip_map_file: %s: empty file", path);
+        close(fd);
+        return NULL;
+    }
+
+    map = (struct rip_map *) calloc(1, sizeof(struct rip_map));
+    if (map == NULL) {
+        perror("calloc");
+        close(fd);
+        return NULL;
+    }
+
+    map->refs = 1;
+    map->len = st.st_size;
+    map->dev = st.st_dev;
+    map->ino = st.st_ino;
+    map->mtime = st.st_mtim;
+    map->base = mmap(NULL, map->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map->base == MAP_FAILED) {
+        perror("mmap");
+        free(map);
+        return NULL;
+    }
+
+    return map;
+}
+
+static int own_strings(struct rip_map *map) {
+    struct rip_metadata *metadata = &map->metadata;
+    char *strings;
+
+    strings = (char *) malloc(metadata->name.len + metadata->artist.len
+                              + metadata->album.len + 1);
+    if (strings == NULL) {
+        perror("malloc");
         return -1;
     }
 
-    out[0] = 2;
+    memcpy(strings, metadata->name.data, metadata->name.len);
+    metadata->name.data = strings;
+    strings += metadata->name.len;
 
-    memcpy(out + 1, &count, 4);
-    if (IS_LITTLE_ENDIAN)
-        *(uint32_t *) (out + 1) = __bswap_32(*(uint32_t *) (out + 1));
+    memcpy(strings, metadata->artist.data, metadata->artist.len);
+    metadata->artist.data = strings;
+    strings += metadata->artist.len;
 
-    memcpy(out + 5, time, 4);
-    if (IS_LITTLE_ENDIAN)
-        *(uint32_t *) (out + 5) = __bswap_32(*(uint32_t *) (out + 5));
+    memcpy(strings, metadata->album.data, metadata->album.len);
+    metadata->album.data = strings;
+
+    map->strings = (char *) metadata->name.data;
+    return 0;
+}
+
+struct rip_map *rip_map_open(const char *path) {
+    struct rip_map *map;
+    int status;
+
+    map = rip_map_file(path);
+    if (map == NULL) return NULL;
 
-    *time += count * 8 / SAMPLESIZE / SAMPLERATE * 100;
+    status = rip_parse_metadata(map->base, map->len, &map->metadata);
+    if (status == 0) status = own_strings(map);
+    if (status == -1) {
+        rip_map_unref(map);
+        return NULL;
+    }
+
+    madvise(map->base, map->len, MADV_SEQUENTIAL);
+    madvise(map->base, map->len, MADV_WILLNEED);
+
+    return map;
+}
+
+struct rip_map *rip_map_view(struct rip_map *parent,
+                             const struct rip_metadata *metadata)
+{
+    struct rip_map *map;
+    uintptr_t start, end, page;
+
+    map = (struct rip_map *) calloc(1, sizeof(struct rip_map));
+    if (map == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+
+    map->refs = 1;
+    map->parent = rip_map_ref(parent);
+    map->base = (void *) metadata->data;
+    map->len = metadata->size;
+    map->metadata = *metadata;
+
+    if (own_strings(map) == -1) {
+        rip_map_unref(map);
+        return NULL;
+    }
+
+    page = sysconf(_SC_PAGESIZE);
+    start = (uintptr_t) metadata->data & ~(page - 1);
+    end = (uintptr_t) metadata->data + metadata->size;
+    if (end > start)
+        madvise((void *) start, end - start, MADV_WILLNEED);
 
-    return count + 9;
+    return map;
 }
 
+struct rip_map *rip_map_ref(struct rip_map *map) {
+    __atomic_add_fetch(&map->refs, 1, __ATOMIC_RELAXED);
+    return map;
+}
+
+void rip_map_unref(struct rip_map *map) {
+    if (map == NULL) return;
+
+    if (__atomic_sub_fetch(&map->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (map->parent != NULL)
+            rip_map_unref(map->parent);
+        else
+            munmap(map->base, map->len);
+        free(map->strings);
+        free(map);
+    }
+}
+
+int rip_map_stale(const struct rip_map *map, const char *path) {
+    struct stat st;
+
+    while (map->parent != NULL) map = map->parent;
+
+    if (stat(path, &st) == -1) return 1;
+
+    return st.st_dev != map->dev || st.st_ino != map->ino
+        || (size_t) st.st_size != map->len
+        || st.st_mtim.tv_sec != map->mtime.tv_sec
+        || st.st_mtim.tv_nsec != map->mtime.tv_nsec;
+}
@@ -3,26 +3,60 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
 
 #define SAMPLESIZE 1
 #define SAMPLERATE 48000
 
+#define BYTERATE (SAMPLESIZE * SAMPLERATE / 8)
+#define HEADERSIZE 9
+
+#define BYTES_TO_CS(bytes) \
+    ((uint32_t) ((uint64_t) (bytes) * 8 / SAMPLESIZE * 100 / SAMPLERATE))
+
+struct rip_string {
+    const char *data;
+    uint16_t len;
+};
+
 struct rip_metadata {
-    char *name;
-    char *artist;
-    char *album;
+    struct rip_string name;
+    struct rip_string artist;
+    struct rip_string album;
     uint32_t length;
+    uint32_t size;
+    const char *data;
 };
 
-int rip_parse_string(FILE *f, char **out);
+struct rip_map {
+    size_t refs;
+    struct rip_map *parent;
+    void *base;
+    size_t len;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    char *strings;
+    struct rip_metadata metadata;
+};
 
-int rip_parse_metadata(FILE *f, struct rip_metadata *metadata);
-size_t rip_encode_metadata(const struct rip_metadata *metadata,
-                           char **out);
-void rip_print_metadata(struct rip_metadata *metadata);
-void rip_free_metadata(struct rip_metadata *metadata);
+int rip_parse_metadata(const char *buf, size_t len,
+                       struct rip_metadata *metadata);
+int rip_decode_metadata(const char *buf, size_t len,
+                        struct rip_metadata *metadata);
+size_t rip_metadata_size(const struct rip_metadata *metadata);
+size_t rip_encode_metadata(const struct rip_metadata *metadata, char *out);
+void rip_print_metadata(const struct rip_metadata *metadata);
 
-size_t rip_read_chunk(FILE *f, char *out, uint32_t *time);
+void rip_encode_header(char *out, uint32_t len, uint64_t position);
 
-#endif
+struct rip_map *rip_map_file(const char *path);
+struct rip_map *rip_map_open(const char *path);
+struct rip_map *rip_map_view(struct rip_map *parent,
+                             const struct rip_metadata *metadata);
+struct rip_map *rip_map_ref(struct rip_map *map);
+int rip_map_stale(const struct rip_map *map, const char *path);
+void rip_map_unref(struct rip_map *map);
 
+#endif
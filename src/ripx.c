@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+#include <sys/mman.h>
+
+#include "rip.h"
+#include "ripx.h"
+#include "log.h"
+
+static uint32_t read_u32(const char *buf) {
+    uint32_t value;
+
+    memcpy(&value, buf, 4);
+    return be32toh(value);
+}
+
+static uint64_t read_u64(const char *buf) {
+    uint64_t value;
+
+    memcpy(&value, buf, 8);
+    return be64toh(value);
+}
+
+static void write_u32(char *buf, uint32_t value) {
+    value = htobe32(value);
+    memcpy(buf, &value, 4);
+}
+
+static void write_u64(char *buf, uint64_t value) {
+    value = htobe64(value);
+    memcpy(buf, &value, 8);
+}
+
+void ripx_encode_header(char *out, uint32_t count) {
+    memcpy(out, RIPXMAGIC, 4);
+    write_u32(out + 4, RIPXVERSION);
+    write_u32(out + 8, count);
+    write_u32(out + 12, 0);
+}
+
+void ripx_encode_entry(char *out, const struct ripx_entry *entry) {
+    write_u32(out, entry->metadata_offset);
+    write_u32(out + 4, entry->metadata_len);
+    write_u64(out + 8, entry->data_offset);
+    write_u32(out + 16, entry->data_len);
+    write_u32(out + 20, 0);
+}
+
+void ripx_entry(const struct ripx *ripx, uint32_t index,
+                struct ripx_entry *entry)
+{
+    const char *buf = (const char *) ripx->map->base + RIPXHEADERSIZE
+        + (size_t) index * RIPXENTRYSIZE;
+
+    entry->metadata_offset = read_u32(buf);
+    entry->metadata_len = read_u32(buf + 4);
+    entry->data_offset = read_u64(buf + 8);
+    entry->data_len = read_u32(buf + 16);
+}
+
+const char *ripx_metadata_packet(const struct ripx *ripx, uint32_t index,
+                                 size_t *len)
+{
+    struct ripx_entry entry;
+
+    ripx_entry(ripx, index, &entry);
+    *len = entry.metadata_len;
+    return (const char *) ripx->map->base + entry.metadata_offset;
+}
+
+static int ripx_validate(struct ripx *ripx) {
+    const char *base = (const char *) ripx->map->base;
+    size_t len = ripx->map->len;
+    struct rip_metadata metadata;
+    struct ripx_entry entry;
+    uint64_t index_end;
+    uint32_t i;
+
+    if (len < RIPXHEADERSIZE || memcmp(base, RIPXMAGIC, 4) != 0) {
+        log_print(LOG_ERROR, "ripx %s: bad signature", ripx->path);
+        return -1;
+    }
+
+    if (read_u32(base + 4) != RIPXVERSION) {
+        log_print(LOG_ERROR, "ripx %s: unsupported version %u", ripx->path,
+                  read_u32(base + 4));
+        return -1;
+    }
+
+    ripx->count = read_u32(base + 8);
+    index_end = RIPXHEADERSIZE + (uint64_t) ripx->count * RIPXENTRYSIZE;
+    if (index_end > len) {
+        log_print(LOG_ERROR, "ripx %s: truncated index", ripx->path);
+        return -1;
+    }
+
+    for (i = 0; i < ripx->count; i++) {
+        ripx_entry(ripx, i, &entry);
+
+        if (entry.metadata_offset < index_end
+            || (uint64_t) entry.metadata_offset + entry.metadata_len > len
+            || entry.data_offset % RIPXALIGN != 0
+            || entry.data_offset < index_end
+            || entry.data_offset > len
+            || entry.data_len > len - entry.data_offset)
+        {
+            log_print(LOG_ERROR, "ripx %s: track %u out of bounds", ripx->path,
+                      i);
+            return -1;
+        }
+
+        if (rip_decode_metadata(base + entry.metadata_offset,
+                                entry.metadata_len, &metadata) == -1)
+        {
+            log_print(LOG_ERROR, "ripx %s: track %u has bad metadata",
+                      ripx->path, i);
+            return -1;
+        }
+
+        if (metadata.length != BYTES_TO_CS(entry.data_len)) {
+            log_print(LOG_ERROR, "ripx %s: track %u length mismatch",
+                      ripx->path, i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int ripx_open(struct ripx *ripx, const char *path) {
+    memset(ripx, 0, sizeof(struct ripx));
+
+    ripx->path = strdup(path);
+    if (ripx->path == NULL) return -1;
+
+    ripx->map = rip_map_file(path);
+    if (ripx->map == NULL) return -1;
+
+    if (ripx_validate(ripx) == -1) return -1;
+
+    madvise(ripx->map->base, ripx->map->len, MADV_RANDOM);
+
+    return 0;
+}
+
+void ripx_free(struct ripx *ripx) {
+    rip_map_unref(ripx->map);
+    free(ripx->path);
+}
+
+struct rip_map *ripx_track(struct ripx *ripx, uint32_t index) {
+    const char *base = (const char *) ripx->map->base;
+    struct rip_metadata metadata;
+    struct ripx_entry entry;
+
+    ripx_entry(ripx, index, &entry);
+
+    if (rip_decode_metadata(base + entry.metadata_offset, entry.metadata_len,
+                            &metadata) == -1)
+        return NULL;
+
+    metadata.data = base + entry.data_offset;
+    metadata.size = entry.data_len;
+
+    return rip_map_view(ripx->map, &metadata);
+}
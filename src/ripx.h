@@ -0,0 +1,38 @@
+#ifndef RIPX_H
+#define RIPX_H
+
+#include <stdint.h>
+
+#include "rip.h"
+
+#define RIPXMAGIC "ripx"
+#define RIPXVERSION 1
+#define RIPXALIGN 4096
+#define RIPXHEADERSIZE 16
+#define RIPXENTRYSIZE 24
+
+struct ripx_entry {
+    uint32_t metadata_offset;
+    uint32_t metadata_len;
+    uint64_t data_offset;
+    uint32_t data_len;
+};
+
+struct ripx {
+    char *path;
+    struct rip_map *map;
+    uint32_t count;
+};
+
+int ripx_open(struct ripx *ripx, const char *path);
+void ripx_free(struct ripx *ripx);
+void ripx_entry(const struct ripx *ripx, uint32_t index,
+                struct ripx_entry *entry);
+const char *ripx_metadata_packet(const struct ripx *ripx, uint32_t index,
+                                 size_t *len);
+struct rip_map *ripx_track(struct ripx *ripx, uint32_t index);
+
+void ripx_encode_header(char *out, uint32_t count);
+void ripx_encode_entry(char *out, const struct ripx_entry *entry);
+
+#endif
@@ -0,0 +1,1570 @@
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <signal.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/timerfd.h>
+#include <linux/errqueue.h>
+
+#include "slab.h"
+#include "ring.h"
+#include "queue.h"
+#include "packet.h"
+#include "uring.h"
+#include "shard.h"
+#include "log.h"
+#include "metrics.h"
+#include "handoff.h"
+
+#define URING_OP_POLL 0
+#define URING_OP_RECV 1
+#define URING_OP_SEND 2
+#define URING_OP_MASK 3
+
+const struct shard_io shard_syscalls = {
+    accept4, recv, recvmsg, sendmsg, setsockopt, shutdown, close, epoll_ctl,
+    metrics_now
+};
+
+static int set_nonblock(int sfd) {
+    int flags, status;
+
+    flags = fcntl(sfd, F_GETFL);
+    if (flags == -1) {
+        perror("fcntl");
+        return -1;
+    }
+
+    flags |= O_NONBLOCK;
+    status = fcntl(sfd, F_SETFL, flags); 
+    if (status == -1) {
+        perror("fcntl");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void unpin(struct packet **pinned) {
+    int i;
+
+    for (i = 0; i < BATCHPACKETS; i++) {
+        packet_unref(pinned[i]);
+        pinned[i] = NULL;
+    }
+}
+
+static void pin(struct packet **pinned, struct packet **packets, int len) {
+    int i;
+
+    for (i = 0; i < len; i++)
+        pinned[i] = packet_ref(packets[i]);
+}
+
+static void client_link(struct client *client) {
+    struct feed *feed = &client->shard->feeds[client->feed];
+    struct client **head = &feed->waiting[client->cursor % RINGSIZE];
+
+    client->prev = NULL;
+    client->next = *head;
+    if (*head != NULL) (*head)->prev = client;
+    *head = client;
+
+    client->linked = 1;
+}
+
+static void client_unlink(struct client *client) {
+    struct feed *feed = &client->shard->feeds[client->feed];
+
+    if (!client->linked) return;
+
+    if (client->prev != NULL)
+        client->prev->next = client->next;
+    else
+        feed->waiting[client->cursor % RINGSIZE] = client->next;
+
+    if (client->next != NULL)
+        client->next->prev = client->prev;
+
+    client->linked = 0;
+}
+
+static void client_seek(struct client *client, uint64_t cursor) {
+    client_unlink(client);
+    client->cursor = cursor;
+    client_link(client);
+}
+
+static void wheel_unlink(struct client *client) {
+    if (!client->timed) return;
+
+    if (client->wheel_prev != NULL)
+        client->wheel_prev->wheel_next = client->wheel_next;
+    else
+        client->shard->wheel[client->deadline % WHEELSIZE] =
+            client->wheel_next;
+
+    if (client->wheel_next != NULL)
+        client->wheel_next->wheel_prev = client->wheel_prev;
+
+    client->timed = 0;
+}
+
+static void wheel_link(struct client *client, uint64_t deadline) {
+    struct client **head = &client->shard->wheel[deadline % WHEELSIZE];
+
+    wheel_unlink(client);
+
+    client->deadline = deadline;
+    client->wheel_prev = NULL;
+    client->wheel_next = *head;
+    if (*head != NULL) (*head)->wheel_prev = client;
+    *head = client;
+
+    client->timed = 1;
+}
+
+static uint32_t ip_slot(const struct sockaddr_storage *addr) {
+    const unsigned char *bytes;
+    uint32_t hash = 2166136261u;
+    size_t i, len;
+
+    if (addr->ss_family == AF_INET6) {
+        bytes = ((const struct sockaddr_in6 *) addr)->sin6_addr.s6_addr;
+        len = 16;
+    } else {
+        bytes = (const unsigned char *)
+            &((const struct sockaddr_in *) addr)->sin_addr.s_addr;
+        len = 4;
+    }
+
+    for (i = 0; i < len; i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+
+    return hash % IPSLOTS;
+}
+
+static const char *client_peer(struct client *client) {
+    return ((struct client_cold *) slab_get_cold(&client->shard->clients,
+                                                 client->index))->peer;
+}
+
+static size_t client_queued(struct client *client) {
+    struct feed *feed = &client->shard->feeds[client->feed];
+    size_t queued = 0;
+
+    if (client->metadata != NULL)
+        queued += client->metadata->len;
+
+    if (client->cursor != feed->ring.head)
+        queued += feed->bytes - feed->offsets[client->cursor % RINGSIZE];
+
+    return queued - client->wrote;
+}
+
+static void client_release(struct client *client) {
+    struct shard *shard = client->shard;
+    struct client_cold *cold = slab_get_cold(&shard->clients, client->index);
+
+    client_unlink(client);
+    wheel_unlink(client);
+    counter_add(&metric_closed, 1);
+    counter_sub(&metric_clients, 1);
+    __atomic_sub_fetch(&shard->config.ip_counts[client->ip_slot], 1,
+                       __ATOMIC_RELAXED);
+    shard->io->close(client->handle.fd);
+    client->handle.fd = -1;
+
+    unpin(cold->inflight);
+
+    packet_unref(client->metadata);
+    client->metadata = NULL;
+
+    while (client->zerocopy_done != client->zerocopy_next)
+        unpin(cold->zerocopy_pinned[client->zerocopy_done++
+                                    % ZEROCOPYSLOTS]);
+
+    slab_remove(&shard->clients, client->index);
+}
+
+static int client_close(struct client *client) {
+    struct shard *shard = client->shard;
+    int status;
+
+    if (client->closing) return 0;
+
+    log_print(LOG_INFO, "closed fd=%d peer=%s", client->handle.fd,
+              client_peer(client));
+
+    shard->io->shutdown(client->handle.fd, SHUT_RDWR);
+    client->closing = 1;
+    wheel_unlink(client);
+
+    if (shard->config.backend == BACKEND_URING) {
+        if (!client->sending && !client->receiving)
+            client_release(client);
+        return 0;
+    }
+
+    status = shard->io->epoll_ctl(shard->efd, EPOLL_CTL_DEL,
+                                  client->handle.fd, NULL);
+    if (status == -1) {
+        perror("epoll_ctl");
+        return -1;
+    }
+
+    client_release(client);
+    return 0;
+}
+
+static struct packet *client_next_packet(struct client *client) {
+    if (client->metadata != NULL)
+        return client->metadata;
+
+    return ring_get(&client->shard->feeds[client->feed].ring, client->cursor);
+}
+
+static void client_advance(struct client *client) {
+    client->wrote = 0;
+
+    if (client->metadata != NULL) {
+        packet_unref(client->metadata);
+        client->metadata = NULL;
+    } else {
+        client_seek(client, client->cursor + 1);
+    }
+}
+
+static void client_jump(struct client *client, uint64_t target) {
+    struct feed *feed = &client->shard->feeds[client->feed];
+
+    if (target <= client->cursor) return;
+
+    if (feed->metadata_seq >= client->cursor && feed->metadata_seq < target) {
+        packet_unref(client->metadata);
+        client->metadata = packet_ref(feed->metadata);
+    }
+
+    client_seek(client, target);
+}
+
+static void client_skip(struct client *client) {
+    struct shard *shard = client->shard;
+    struct feed *feed = &shard->feeds[client->feed];
+
+    if (shard->config.policy == POLICY_SKIP)
+        client_jump(client, feed->ring.head - 1);
+    else
+        client_jump(client, feed->ring.head - shard->config.lag / 2);
+}
+
+static int client_lagging(struct client *client) {
+    struct shard *shard = client->shard;
+    struct feed *feed = &shard->feeds[client->feed];
+    uint64_t lag = feed->ring.head - client->cursor;
+
+    if (shard->config.policy != POLICY_DROP && !client->sending
+        && client->wrote == 0)
+    {
+        client_skip(client);
+        return 0;
+    }
+
+    if (shard->config.policy != POLICY_DROP && lag < RINGSIZE)
+        return 0;
+
+    counter_add(&metric_lagged, 1);
+    log_print(LOG_WARN, "lagged fd=%d peer=%s ticks=%llu bytes=%zu",
+              client->handle.fd, client_peer(client),
+              (unsigned long long) lag, client_queued(client));
+
+    return client_close(client);
+}
+
+static int client_batch(struct client *client, struct iovec *iov,
+                        struct packet **packets, int *packets_len)
+{
+    ring_t *ring = &client->shard->feeds[client->feed].ring;
+    struct packet *packet = client->metadata;
+    uint64_t seq = client->cursor;
+    size_t offset = client->wrote;
+    int n = 0, len = 0, skipping;
+
+    skipping = client->shard->config.policy != POLICY_DROP
+        && ring->head - client->cursor > client->shard->config.lag;
+
+    if (client->wrote == 0 && skipping) {
+        client_skip(client);
+        packet = client->metadata;
+        seq = client->cursor;
+        skipping = 0;
+    }
+
+    if (packet == NULL) packet = ring_get(ring, seq++);
+
+    while (packet != NULL && len < BATCHPACKETS) {
+        n += packet_iov(packet, offset, iov + n);
+        packets[len++] = packet;
+        offset = 0;
+
+        if (skipping) break;
+
+        packet = ring_get(ring, seq++);
+    }
+
+    *packets_len = len;
+    return n;
+}
+
+static void client_consume(struct client *client, size_t count) {
+    struct packet *packet;
+    size_t len;
+
+    client->active = client->shard->now;
+
+    counter_add(&metric_writes, 1);
+    counter_add(&metric_bytes, count);
+    histogram_observe(&metric_write_size, count);
+
+    while (count > 0) {
+        packet = client_next_packet(client);
+        len = packet->len - client->wrote;
+
+        if (count < len) {
+            client->wrote += count;
+            return;
+        }
+
+        count -= len;
+        client_advance(client);
+    }
+}
+
+static int client_hello(struct client *client, const char *name,
+                        size_t name_len)
+{
+    struct shard *shard = client->shard;
+    struct feed *feed;
+    uint64_t history;
+    int i;
+
+    if (name_len == 0) {
+        client->feed = 0;
+    } else {
+        for (i = 0; i < shard->feeds_len; i++) {
+            if (strlen(shard->feeds[i].name) == name_len
+                && memcmp(shard->feeds[i].name, name, name_len) == 0)
+                break;
+        }
+
+        if (i == shard->feeds_len) return -1;
+        client->feed = i;
+    }
+
+    feed = &shard->feeds[client->feed];
+    history = 0;
+    client->metadata = NULL;
+
+    if (feed->metadata != NULL) {
+        history = feed->ring.head - feed->metadata_seq - 1;
+        if (history > shard->config.burst)
+            history = shard->config.burst;
+        if (history > feed->ring.head - ring_tail(&feed->ring))
+            history = feed->ring.head - ring_tail(&feed->ring);
+
+        client->metadata = packet_ref(feed->metadata);
+    }
+
+    client->cursor = feed->ring.head - history;
+    client->wrote = 0;
+    client->initialized = 1;
+    client->active = shard->now;
+    client_link(client);
+    wheel_link(client, shard->now + IDLETIMEOUT);
+
+    log_print(LOG_INFO, "initialized fd=%d peer=%s station=%s%s",
+              client->handle.fd, client_peer(client), feed->name,
+              feed->metadata == NULL ? " (waiting for upstream)" : "");
+
+    return 0;
+}
+
+static int client_greet(struct client *client, size_t count) {
+    struct shard *shard = client->shard;
+    struct client_cold *cold = slab_get_cold(&shard->clients, client->index);
+    size_t need;
+
+    cold->hello_len += count;
+
+    if (cold->hello[0] == '\0') {
+        if (cold->hello_len == 1) return client_hello(client, NULL, 0);
+
+        need = 2 + (unsigned char) cold->hello[1];
+        if (cold->hello_len != need) return -1;
+
+        return client_hello(client, cold->hello + 2, need - 2);
+    }
+
+    if (cold->hello[0] != HELLOSTATION) return -1;
+    if (cold->hello_len < 2) return 0;
+
+    need = 2 + (unsigned char) cold->hello[1];
+    if (cold->hello_len > need) return -1;
+    if (cold->hello_len < need) return 0;
+
+    return client_hello(client, cold->hello + 2, need - 2);
+}
+
+static int client_submit_recv(struct client *client) {
+    struct shard *shard = client->shard;
+    struct client_cold *cold = slab_get_cold(&shard->clients, client->index);
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_sqe(&shard->uring);
+    if (sqe == NULL) return -1;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = client->handle.fd;
+    sqe->addr = (uint64_t) (uintptr_t) (cold->hello + cold->hello_len);
+    sqe->len = HELLOSIZE - cold->hello_len;
+    sqe->user_data = (uint64_t) (uintptr_t) &client->handle | URING_OP_RECV;
+
+    client->receiving = 1;
+    return 0;
+}
+
+static int client_submit_send(struct client *client) {
+    struct shard *shard = client->shard;
+    struct client_cold *cold = slab_get_cold(&shard->clients, client->index);
+    struct packet *packets[BATCHPACKETS];
+    struct io_uring_sqe *sqe;
+    int n, len;
+
+    n = client_batch(client, cold->iov, packets, &len);
+    if (n == 0) return 0;
+
+    sqe = uring_sqe(&shard->uring);
+    if (sqe == NULL) return -1;
+
+    memset(&cold->msg, 0, sizeof cold->msg);
+    cold->msg.msg_iov = cold->iov;
+    cold->msg.msg_iovlen = n;
+
+    sqe->fd = client->handle.fd;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->addr = (uint64_t) (uintptr_t) &cold->msg;
+    sqe->len = 1;
+
+    sqe->user_data = (uint64_t) (uintptr_t) &client->handle | URING_OP_SEND;
+
+    pin(cold->inflight, packets, len);
+    client->sending = 1;
+    return 0;
+}
+
+static int client_complete(struct client *client, int op, int res) {
+    struct shard *shard = client->shard;
+    struct client_cold *cold = slab_get_cold(&shard->clients, client->index);
+
+    if (op == URING_OP_RECV) {
+        client->receiving = 0;
+    } else {
+        client->sending = 0;
+
+        if (!client->closing && res > 0)
+            client_consume(client, res);
+
+        unpin(cold->inflight);
+    }
+
+    if (client->closing) {
+        if (!client->sending && !client->receiving)
+            client_release(client);
+        return 0;
+    }
+
+    if (res == -EAGAIN || res == -EINTR) {
+        if (op == URING_OP_RECV) return client_submit_recv(client);
+        counter_add(&metric_eagain, res == -EAGAIN);
+        return client_submit_send(client);
+    }
+
+    if (res <= 0)
+        return client_close(client);
+
+    if (op == URING_OP_RECV) {
+        if (client->initialized || client_greet(client, res) == -1)
+            return client_close(client);
+        if (!client->initialized) return client_submit_recv(client);
+    }
+
+    return client_submit_send(client);
+}
+
+static int client_read(struct client *client) {
+    struct shard *shard = client->shard;
+    struct client_cold *cold = slab_get_cold(&shard->clients, client->index);
+    ssize_t count;
+    struct epoll_event event;
+    int status;
+
+    count = shard->io->recv(client->handle.fd, cold->hello + cold->hello_len,
+                            HELLOSIZE - cold->hello_len, 0);
+    if (count == 0 || (count == -1 && errno != EAGAIN)
+        || (count > 0 && client_greet(client, count) == -1))
+        return client_close(client);
+
+    event.data.u64 = CLIENT_EVENT(client->index);
+    event.events = client->initialized ? EPOLLOUT | EPOLLET
+        : EPOLLIN | EPOLLONESHOT;
+
+    status = shard->io->epoll_ctl(shard->efd, EPOLL_CTL_MOD,
+                                  client->handle.fd, &event);
+    if (status == -1) {
+        perror("epoll_ctl");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int client_reap(struct client *client) {
+    struct client_cold *cold = slab_get_cold(&client->shard->clients,
+                                             client->index);
+    struct sock_extended_err *err;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    char control[128];
+    uint32_t hi;
+    ssize_t count;
+
+    while (1) {
+        memset(&msg, 0, sizeof msg);
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+
+        count = client->shard->io->recvmsg(client->handle.fd, &msg,
+                                           MSG_ERRQUEUE);
+        if (count == -1) {
+            if (errno == EAGAIN) break;
+            return -1;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                && !(cmsg->cmsg_level == SOL_IPV6
+                     && cmsg->cmsg_type == IPV6_RECVERR))
+                continue;
+
+            err = (struct sock_extended_err *) CMSG_DATA(cmsg);
+            if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY || err->ee_errno != 0)
+                return -1;
+
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                client->zerocopy = 0;
+
+            hi = err->ee_data;
+            while (client->zerocopy_done != client->zerocopy_next
+                   && (int32_t) (hi - client->zerocopy_done) >= 0)
+                unpin(cold->zerocopy_pinned[client->zerocopy_done++
+                                            % ZEROCOPYSLOTS]);
+        }
+    }
+
+    return 0;
+}
+
+static ssize_t client_send(struct client *client) {
+    struct packet *packets[BATCHPACKETS];
+    struct iovec iov[BATCHIOV];
+    int flags = MSG_NOSIGNAL;
+    struct client_cold *cold;
+    struct msghdr msg;
+    ssize_t count;
+    size_t len = 0;
+    int i, n;
+
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = client_batch(client, iov, packets, &n);
+    if (msg.msg_iovlen == 0) return 0;
+
+    for (i = 0; i < (int) msg.msg_iovlen; i++)
+        len += iov[i].iov_len;
+
+    if (client->zerocopy && len >= ZEROCOPYMIN
+        && client->zerocopy_next - client->zerocopy_done < ZEROCOPYSLOTS)
+        flags |= MSG_ZEROCOPY;
+
+    count = client->shard->io->sendmsg(client->handle.fd, &msg, flags);
+
+    if (count > 0 && flags & MSG_ZEROCOPY) {
+        cold = slab_get_cold(&client->shard->clients, client->index);
+        pin(cold->zerocopy_pinned[client->zerocopy_next++ % ZEROCOPYSLOTS],
+            packets, n);
+    }
+
+    return count;
+}
+
+static int client_write(struct client *client) {
+    ssize_t count;
+
+    while (1) {
+        count = client_send(client);
+        if (count == 0) return 0;
+
+        if (count == -1) {
+            if (errno == EAGAIN) {
+                counter_add(&metric_eagain, 1);
+                return 0;
+            }
+            return client_close(client);
+        }
+
+        client_consume(client, count);
+    }
+}
+
+static int client_event(struct handle *handle, uint32_t events) {
+    struct client *client = container_of(handle, struct client, handle);
+
+    if (handle->fd == -1 || client->closing) return 0;
+
+    if (events & EPOLLERR && client->zerocopy_done != client->zerocopy_next) {
+        if (client_reap(client) == -1)
+            return client_close(client);
+
+        events &= ~EPOLLERR;
+    }
+
+    if (events & EPOLLIN)
+        return client_read(client);
+    else if (events & EPOLLOUT)
+        return client_write(client);
+    else if (events & EPOLLHUP || events & EPOLLERR)
+        return client_close(client);
+
+    return 0;
+}
+
+static void peer_host(const struct sockaddr_storage *addr, char *host) {
+    if (addr->ss_family == AF_INET6)
+        inet_ntop(AF_INET6, &((const struct sockaddr_in6 *) addr)->sin6_addr,
+                  host, INET6_ADDRSTRLEN);
+    else
+        inet_ntop(AF_INET, &((const struct sockaddr_in *) addr)->sin_addr,
+                  host, INET6_ADDRSTRLEN);
+}
+
+static struct client *client_new(struct shard *shard, int fd, uint32_t slot,
+                                 const char *host)
+{
+    struct client_cold *cold;
+    struct client *client;
+    struct client new_client;
+    size_t index;
+
+    new_client.handle.fd = fd;
+    new_client.handle.events = 0;
+    new_client.handle.handler = client_event;
+    new_client.shard = shard;
+    new_client.feed = 0;
+    new_client.initialized = 0;
+    new_client.closing = 0;
+    new_client.receiving = 0;
+    new_client.sending = 0;
+    new_client.zerocopy = 0;
+    new_client.linked = 0;
+    new_client.timed = 0;
+    new_client.next = NULL;
+    new_client.prev = NULL;
+    new_client.ip_slot = slot;
+    new_client.active = shard->now;
+    new_client.zerocopy_next = 0;
+    new_client.zerocopy_done = 0;
+    new_client.metadata = NULL;
+    new_client.cursor = 0;
+    new_client.wrote = 0;
+
+    index = slab_insert(&shard->clients, &new_client);
+    if (index == (size_t) -1) {
+        log_print(LOG_ERROR, "out of client slots, closing fd=%d peer=%s",
+                  fd, host);
+        __atomic_sub_fetch(&shard->config.ip_counts[slot], 1,
+                           __ATOMIC_RELAXED);
+        shard->io->close(fd);
+        return NULL;
+    }
+
+    client = (struct client *) slab_get(&shard->clients, index);
+    client->index = index;
+
+    cold = slab_get_cold(&shard->clients, index);
+    memset(cold->inflight, 0, sizeof cold->inflight);
+    memset(cold->zerocopy_pinned, 0, sizeof cold->zerocopy_pinned);
+    memcpy(cold->peer, host, sizeof cold->peer);
+    cold->hello_len = 0;
+
+    counter_add(&metric_clients, 1);
+    return client;
+}
+
+static int listener_accept(struct handle *handle,
+                           uint32_t events __attribute__((unused)))
+{
+    struct shard *shard = container_of(handle, struct shard, listener);
+    struct client *client;
+    int status, accepted;
+    struct epoll_event event;
+
+    shard->accept_pending = 0;
+
+    for (accepted = 0; accepted < ACCEPTBATCH; accepted++) {
+        int infd;
+        uint32_t slot, count;
+        struct sockaddr_storage in_addr;
+        char host[INET6_ADDRSTRLEN];
+        socklen_t in_addrlen = sizeof in_addr;
+
+        infd = shard->io->accept4(handle->fd, (struct sockaddr *) &in_addr,
+                                  &in_addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (infd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                log_print(LOG_ERROR, "accept: %s", strerror(errno));
+            return 0;
+        }
+
+        slot = ip_slot(&in_addr);
+        count = __atomic_add_fetch(&shard->config.ip_counts[slot], 1,
+                                   __ATOMIC_RELAXED);
+
+        peer_host(&in_addr, host);
+
+        if (shard->config.per_ip != 0 && count > shard->config.per_ip) {
+            __atomic_sub_fetch(&shard->config.ip_counts[slot], 1,
+                               __ATOMIC_RELAXED);
+            counter_add(&metric_rejected, 1);
+            log_print(LOG_WARN, "rejected fd=%d peer=%s: too many "
+                      "connections", infd, host);
+            shard->io->close(infd);
+            continue;
+        }
+
+        client = client_new(shard, infd, slot, host);
+        if (client == NULL) continue;
+
+        counter_add(&metric_accepted, 1);
+        log_print(LOG_INFO, "accepted fd=%d peer=%s", infd, host);
+
+        wheel_link(client, shard->now + HANDSHAKETIMEOUT);
+
+        status = shard->io->setsockopt(infd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                                       &(int){NOTSENTLOWAT}, sizeof(int));
+        if (status == -1)
+            perror("setsockopt");
+
+        if (shard->config.backend == BACKEND_URING) {
+            status = client_submit_recv(client);
+            if (status == -1) return -1;
+            continue;
+        }
+
+        if (shard->config.zerocopy) {
+            status = shard->io->setsockopt(infd, SOL_SOCKET, SO_ZEROCOPY,
+                                           &(int){1}, sizeof(int));
+            client->zerocopy = status == 0;
+        }
+
+        event.data.u64 = CLIENT_EVENT(client->index);
+        event.events = EPOLLIN | EPOLLONESHOT;
+
+        status = shard->io->epoll_ctl(shard->efd, EPOLL_CTL_ADD, infd,
+                                      &event);
+        if (status == -1) {
+            perror("epoll_ctl");
+            return -1;
+        }
+    }
+
+    shard->accept_pending = 1;
+    return 0;
+}
+
+static int feed_expire(struct shard *shard, struct feed *feed, uint64_t seq) {
+    struct client *client, *next;
+    uint64_t cursors[2];
+    int i, status;
+
+    cursors[0] = seq - shard->config.lag;
+    cursors[1] = seq - RINGSIZE;
+
+    for (i = 0; i < 2; i++) {
+        for (client = feed->waiting[cursors[i] % RINGSIZE]; client != NULL;
+             client = next)
+        {
+            next = client->next;
+            if (client->cursor != cursors[i] || client->closing) continue;
+
+            status = client_lagging(client);
+            if (status == -1) return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void feed_resync(struct shard *shard, struct feed *feed) {
+    struct client *client, *next;
+    uint64_t target = feed->resync_seq;
+    int i;
+
+    feed->resync = 0;
+    if (target < ring_tail(&feed->ring)) target = ring_tail(&feed->ring);
+
+    for (i = 0; i < RINGSIZE; i++) {
+        for (client = feed->waiting[i]; client != NULL; client = next) {
+            next = client->next;
+            if (client->closing || client->sending || client->wrote != 0)
+                continue;
+
+            client_jump(client, target);
+        }
+    }
+
+    log_print(LOG_WARN, "resynced station=%s on shard=%d", feed->name,
+              shard->id);
+}
+
+static int feed_wake(struct shard *shard, struct feed *feed) {
+    struct client *client, *next;
+    uint64_t seq;
+    int status;
+
+    for (seq = feed->head; seq != feed->ring.head; seq++) {
+        for (client = feed->waiting[seq % RINGSIZE]; client != NULL;
+             client = next)
+        {
+            next = client->next;
+            if (client->cursor != seq || client->closing) continue;
+
+            if (shard->config.backend == BACKEND_URING) {
+                if (client->sending) continue;
+                status = client_submit_send(client);
+            } else {
+                status = client_write(client);
+            }
+
+            if (status == -1) return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int wheel_expire(struct shard *shard) {
+    struct client *client, *next;
+    int status;
+
+    client = shard->wheel[shard->now % WHEELSIZE];
+    shard->wheel[shard->now % WHEELSIZE] = NULL;
+
+    for (; client != NULL; client = next) {
+        next = client->wheel_next;
+        client->timed = 0;
+
+        if (client->deadline > shard->now) {
+            wheel_link(client, client->deadline);
+            continue;
+        }
+
+        if (!client->initialized) {
+            counter_add(&metric_timeouts, 1);
+            log_print(LOG_INFO, "handshake timeout fd=%d peer=%s",
+                      client->handle.fd, client_peer(client));
+            status = client_close(client);
+            if (status == -1) return -1;
+            continue;
+        }
+
+        if (client_queued(client) == 0)
+            client->active = shard->now;
+
+        if (shard->now - client->active >= IDLETIMEOUT) {
+            counter_add(&metric_timeouts, 1);
+            log_print(LOG_INFO, "idle timeout fd=%d peer=%s",
+                      client->handle.fd, client_peer(client));
+            status = client_close(client);
+            if (status == -1) return -1;
+            continue;
+        }
+
+        wheel_link(client, client->active + IDLETIMEOUT);
+    }
+
+    return 0;
+}
+
+int shard_advance(struct shard *shard, uint64_t seconds) {
+    int status;
+
+    while (seconds-- > 0) {
+        shard->now++;
+
+        status = wheel_expire(shard);
+        if (status == -1) return -1;
+    }
+
+    return listener_accept(&shard->listener, 0);
+}
+
+static int wheel_read(struct handle *handle,
+                      uint32_t events __attribute__((unused)))
+{
+    struct shard *shard = container_of(handle, struct shard, wheel_event);
+    uint64_t expirations;
+    ssize_t count;
+
+    count = read(handle->fd, &expirations, 8);
+    if (count != 8) {
+        if (errno == EAGAIN) return 0;
+        perror("read");
+        return -1;
+    }
+
+    return shard_advance(shard, expirations);
+}
+
+static int inbox_drain(struct shard *shard) {
+    struct message message;
+    struct feed *feed;
+    uint64_t seq, published = 0;
+    int i, status;
+
+    for (i = 0; i < shard->feeds_len; i++)
+        shard->feeds[i].head = shard->feeds[i].ring.head;
+
+    while (queue_pop(&shard->inbox, &message) == 0) {
+        feed = &shard->feeds[message.feed];
+        seq = feed->ring.head;
+
+        if (published == 0 || message.time < published)
+            published = message.time;
+
+        if (message.resync) {
+            for (i = 0; i < shard->feeds_len; i++) {
+                shard->feeds[i].resync_seq = shard->feeds[i].ring.head;
+                shard->feeds[i].resync = 1;
+            }
+        }
+
+        if (message.packet->data[0] == 1) {
+            packet_unref(feed->metadata);
+            feed->metadata = packet_ref(message.packet);
+            feed->metadata_seq = seq;
+        }
+
+        feed->offsets[seq % RINGSIZE] = feed->bytes;
+        feed->bytes += message.packet->len;
+        ring_push(&feed->ring, message.packet);
+
+        status = feed_expire(shard, feed, seq);
+        if (status == -1) return -1;
+    }
+
+    for (i = 0; i < shard->feeds_len; i++) {
+        if (shard->feeds[i].resync) feed_resync(shard, &shard->feeds[i]);
+
+        status = feed_wake(shard, &shard->feeds[i]);
+        if (status == -1) return -1;
+    }
+
+    if (published != 0)
+        histogram_observe(&metric_fanout, shard->io->clock() - published);
+
+    return 0;
+}
+
+static int inbox_read(struct handle *handle,
+                      uint32_t events __attribute__((unused)))
+{
+    struct shard *shard = container_of(handle, struct shard, inbox_event);
+    uint64_t value;
+    ssize_t count;
+
+    count = read(handle->fd, &value, 8);
+    if (count != 8) return 0;
+
+    return inbox_drain(shard);
+}
+
+int shard_new(struct shard *shard, int id, int sfd,
+              const struct shard_config *config, const char **feeds,
+              int feeds_len)
+{
+    int i, status;
+
+    shard->id = id;
+    shard->config = *config;
+    shard->io = config->io != NULL ? config->io : &shard_syscalls;
+    shard->running = 1;
+    shard->efd = -1;
+    shard->accept_pending = 0;
+    shard->now = 0;
+    shard->backlog_len = 0;
+    memset(shard->wheel, 0, sizeof shard->wheel);
+
+    status = slab_new_split(&shard->clients, CLIENTSCAPACITY,
+                            sizeof(struct client), sizeof(struct client_cold));
+    if (status == -1) return -1;
+
+    shard->feeds = (struct feed *) calloc(feeds_len, sizeof(struct feed));
+    if (shard->feeds == NULL) return -1;
+    shard->feeds_len = feeds_len;
+
+    for (i = 0; i < feeds_len; i++) {
+        shard->feeds[i].name = feeds[i];
+
+        status = ring_new(&shard->feeds[i].ring, RINGSIZE);
+        if (status == -1) return -1;
+    }
+
+    status = queue_new(&shard->inbox, INBOXSIZE, sizeof(struct message));
+    if (status == -1) return -1;
+
+    shard->backlog_cap = (size_t) RINGSIZE * feeds_len;
+    shard->backlog = (struct message *) malloc(shard->backlog_cap
+                                               * sizeof(struct message));
+    if (shard->backlog == NULL) return -1;
+
+    if (config->backend == BACKEND_URING) {
+        status = uring_new(&shard->uring, URINGSIZE);
+        if (status == -1) return -1;
+    } else {
+        shard->efd = epoll_create1(EPOLL_CLOEXEC);
+        if (shard->efd == -1) {
+            perror("epoll_create");
+            return -1;
+        }
+    }
+
+    shard->inbox_event.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (shard->inbox_event.fd == -1) {
+        perror("eventfd");
+        return -1;
+    }
+    shard->inbox_event.handler = inbox_read;
+
+    status = shard_watch(shard, &shard->inbox_event, EPOLLIN);
+    if (status == -1) return -1;
+
+    shard->wheel_event.fd = timerfd_create(CLOCK_MONOTONIC,
+                                         TFD_NONBLOCK | TFD_CLOEXEC);
+    if (shard->wheel_event.fd == -1) {
+        perror("timerfd_create");
+        return -1;
+    }
+    shard->wheel_event.handler = wheel_read;
+
+    status = timerfd_settime(shard->wheel_event.fd, 0,
+                             &(struct itimerspec){{1, 0}, {1, 0}}, NULL);
+    if (status == -1) {
+        perror("timerfd_settime");
+        return -1;
+    }
+
+    status = shard_watch(shard, &shard->wheel_event, EPOLLIN);
+    if (status == -1) return -1;
+
+    status = set_nonblock(sfd);
+    if (status == -1) return -1;
+
+    status = listen(sfd, SOMAXCONN);
+    if (status == -1) {
+        perror("listen");
+        return -1;
+    }
+
+    shard->listener.fd = sfd;
+    shard->listener.handler = listener_accept;
+
+    return shard_watch(shard, &shard->listener, EPOLLIN | EPOLLET);
+}
+
+void shard_free(struct shard *shard) {
+    struct message message;
+    slab_iter_t iter;
+    int i;
+
+    for (slab_iter_create(&shard->clients, &iter); !slab_iter_done(&iter);
+         slab_iter_next(&shard->clients, &iter))
+    {
+        shard->io->shutdown(((struct client *) iter.data)->handle.fd,
+                            SHUT_RDWR);
+        client_release((struct client *) iter.data);
+    }
+
+    while (queue_pop(&shard->inbox, &message) == 0)
+        packet_unref(message.packet);
+
+    while (shard->backlog_len > 0)
+        packet_unref(shard->backlog[--shard->backlog_len].packet);
+    free(shard->backlog);
+
+    close(shard->listener.fd);
+    close(shard->inbox_event.fd);
+    close(shard->wheel_event.fd);
+    if (shard->config.backend == BACKEND_URING)
+        uring_free(&shard->uring);
+    else
+        close(shard->efd);
+
+    for (i = 0; i < shard->feeds_len; i++) {
+        packet_unref(shard->feeds[i].metadata);
+        ring_free(&shard->feeds[i].ring);
+    }
+
+    free(shard->feeds);
+    queue_free(&shard->inbox);
+    slab_free(&shard->clients);
+}
+
+static int client_export(struct client *client, int sock) {
+    ring_t *ring = &client->shard->feeds[client->feed].ring;
+    struct client_cold *cold = slab_get_cold(&client->shard->clients,
+                                             client->index);
+    struct handoff_client state;
+    struct packet *packet;
+    struct iovec iov[2];
+    uint64_t seq = client->cursor;
+    size_t offset = client->wrote, len;
+    int i, n, status;
+
+    memset(&state, 0, sizeof state);
+    state.feed = client->feed;
+    state.initialized = client->initialized;
+    state.zerocopy = client->zerocopy;
+    state.zerocopy_next = client->zerocopy_next;
+    state.zerocopy_done = client->zerocopy_done;
+    state.backlog = client->initialized ? client_queued(client) : 0;
+    state.hello_len = cold->hello_len;
+    memcpy(state.hello, cold->hello, cold->hello_len);
+
+    status = handoff_send(sock, HANDOFF_CLIENT, &state, sizeof state,
+                          client->handle.fd);
+    if (status == -1 || state.backlog == 0) return status;
+
+    packet = client->metadata;
+    if (packet == NULL) packet = ring_get(ring, seq++);
+
+    while (packet != NULL) {
+        n = packet_iov(packet, offset, iov);
+
+        for (i = 0; i < n; i++) {
+            while (iov[i].iov_len > 0) {
+                len = iov[i].iov_len < HANDOFFCHUNK
+                    ? iov[i].iov_len : HANDOFFCHUNK;
+
+                status = handoff_send(sock, HANDOFF_BACKLOG, iov[i].iov_base,
+                                      len, -1);
+                if (status == -1) return -1;
+
+                iov[i].iov_base = (char *) iov[i].iov_base + len;
+                iov[i].iov_len -= len;
+            }
+        }
+
+        offset = 0;
+        packet = ring_get(ring, seq++);
+    }
+
+    return 0;
+}
+
+int shard_export(struct shard *shard, int sock) {
+    struct handoff_listener listener;
+    struct client *client;
+    slab_iter_t iter;
+    int status;
+
+    status = inbox_drain(shard);
+    if (status == -1) return -1;
+
+    listener.clients = 0;
+    for (slab_iter_create(&shard->clients, &iter); !slab_iter_done(&iter);
+         slab_iter_next(&shard->clients, &iter))
+        if (!((struct client *) iter.data)->closing) listener.clients++;
+
+    status = handoff_send(sock, HANDOFF_LISTENER, &listener, sizeof listener,
+                          shard->listener.fd);
+    if (status == -1) return -1;
+
+    for (slab_iter_create(&shard->clients, &iter); !slab_iter_done(&iter);
+         slab_iter_next(&shard->clients, &iter))
+    {
+        client = (struct client *) iter.data;
+        if (client->closing) continue;
+
+        status = client_export(client, sock);
+        if (status == -1) return -1;
+    }
+
+    log_print(LOG_INFO, "handed off shard=%d clients=%u", shard->id,
+              listener.clients);
+
+    return 0;
+}
+
+int shard_adopt(struct shard *shard, int fd,
+                const struct handoff_client *state, struct packet *backlog)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof addr;
+    char host[INET6_ADDRSTRLEN];
+    struct epoll_event event;
+    struct client_cold *cold;
+    struct client *client;
+    uint32_t slot;
+    int status;
+
+    if (shard->config.backend == BACKEND_URING) {
+        fprintf(stderr, "shard %d: cannot adopt clients with uring\n",
+                shard->id);
+        packet_unref(backlog);
+        shard->io->close(fd);
+        return -1;
+    }
+
+    if (state->feed < 0 || state->feed >= shard->feeds_len
+        || getpeername(fd, (struct sockaddr *) &addr, &addrlen) == -1)
+    {
+        packet_unref(backlog);
+        shard->io->close(fd);
+        return 0;
+    }
+
+    slot = ip_slot(&addr);
+    __atomic_add_fetch(&shard->config.ip_counts[slot], 1, __ATOMIC_RELAXED);
+    peer_host(&addr, host);
+
+    client = client_new(shard, fd, slot, host);
+    if (client == NULL) {
+        packet_unref(backlog);
+        return 0;
+    }
+
+    client->zerocopy = state->zerocopy;
+    client->zerocopy_next = state->zerocopy_next;
+    client->zerocopy_done = state->zerocopy_done;
+
+    if (state->initialized) {
+        client->feed = state->feed;
+        client->metadata = backlog;
+        client->cursor = shard->feeds[client->feed].ring.head;
+        client->initialized = 1;
+        client_link(client);
+        wheel_link(client, shard->now + IDLETIMEOUT);
+        event.events = EPOLLOUT | EPOLLET;
+    } else {
+        packet_unref(backlog);
+        wheel_link(client, shard->now + HANDSHAKETIMEOUT);
+        event.events = EPOLLIN | EPOLLONESHOT;
+
+        cold = slab_get_cold(&shard->clients, client->index);
+        cold->hello_len = state->hello_len < HELLOSIZE ? state->hello_len : 0;
+        memcpy(cold->hello, state->hello, cold->hello_len);
+    }
+
+    log_print(LOG_INFO, "adopted fd=%d peer=%s", fd, host);
+
+    event.data.u64 = CLIENT_EVENT(client->index);
+
+    status = shard->io->epoll_ctl(shard->efd, EPOLL_CTL_ADD, fd, &event);
+    if (status == -1) {
+        perror("epoll_ctl");
+        return -1;
+    }
+
+    return 0;
+}
+
+void shard_resume(struct shard *shard, int feed, struct packet *metadata) {
+    struct feed *resumed = &shard->feeds[feed];
+
+    packet_unref(resumed->metadata);
+    resumed->metadata = packet_ref(metadata);
+    resumed->metadata_seq = resumed->ring.head - 1;
+}
+
+static int uring_poll(struct shard *shard, struct handle *handle) {
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_sqe(&shard->uring);
+    if (sqe == NULL) return -1;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = handle->fd;
+    sqe->poll32_events = handle->events
+        & ~(uint32_t) (EPOLLET | EPOLLONESHOT);
+    sqe->len = handle->events & EPOLLONESHOT ? 0 : IORING_POLL_ADD_MULTI;
+    sqe->user_data = (uint64_t) (uintptr_t) handle | URING_OP_POLL;
+
+    return 0;
+}
+
+int shard_watch(struct shard *shard, struct handle *handle, uint32_t events) {
+    struct epoll_event event;
+    int status;
+
+    handle->events = events;
+
+    if (shard->config.backend == BACKEND_URING)
+        return uring_poll(shard, handle);
+
+    event.data.ptr = handle;
+    event.events = events;
+
+    status = epoll_ctl(shard->efd, EPOLL_CTL_ADD, handle->fd, &event);
+    if (status == -1) {
+        perror("epoll_ctl");
+        return -1;
+    }
+
+    return 0;
+}
+
+int shard_dispatch(struct shard *shard, uint64_t data, uint32_t events) {
+    struct client *client;
+    struct handle *handle;
+
+    if (data & CLIENTEVENT) {
+        client = slab_get(&shard->clients, CLIENT_EVENT_KEY(data));
+        if (client == NULL) return 0;
+
+        handle = &client->handle;
+    } else {
+        handle = (struct handle *) (uintptr_t) data;
+    }
+
+    return handle->handler(handle, events);
+}
+
+static int shard_run_epoll(struct shard *shard) {
+    struct epoll_event events[MAXEVENTS];
+    int n, i, status;
+
+    while (__atomic_load_n(&shard->running, __ATOMIC_ACQUIRE)) {
+        n = epoll_wait(shard->efd, events, MAXEVENTS,
+                       shard->accept_pending ? 0 : -1);
+
+        if (n == -1) {
+            if (errno == EINTR) return 0;
+            perror("epoll_wait");
+            return -1;
+        }
+
+        for (i = 0; i < n; i++) {
+            status = shard_dispatch(shard, events[i].data.u64,
+                                    events[i].events);
+            if (status == -1) return -1;
+
+            if (!__atomic_load_n(&shard->running, __ATOMIC_ACQUIRE))
+                return 0;
+        }
+
+        if (shard->accept_pending) {
+            status = listener_accept(&shard->listener, 0);
+            if (status == -1) return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int shard_run_uring(struct shard *shard) {
+    struct io_uring_cqe cqe;
+    struct handle *handle;
+    int op, status, rearm;
+
+    while (__atomic_load_n(&shard->running, __ATOMIC_ACQUIRE)) {
+        status = uring_submit(&shard->uring, !shard->accept_pending);
+        if (status == -1) {
+            if (errno == EINTR) return 0;
+            return -1;
+        }
+
+        while (uring_cqe(&shard->uring, &cqe) == 0) {
+            handle = (struct handle *) (uintptr_t)
+                (cqe.user_data & ~(uint64_t) URING_OP_MASK);
+            op = cqe.user_data & URING_OP_MASK;
+
+            if (op == URING_OP_POLL) {
+                if (cqe.res < 0) {
+                    fprintf(stderr, "poll: %s\n", strerror(-cqe.res));
+                    return -1;
+                }
+
+                rearm = !(cqe.flags & IORING_CQE_F_MORE)
+                    && !(handle->events & EPOLLONESHOT);
+
+                status = handle->handler(handle, cqe.res);
+                if (status == -1) return -1;
+
+                if (rearm) {
+                    status = uring_poll(shard, handle);
+                    if (status == -1) return -1;
+                }
+            } else {
+                status = client_complete(
+                    container_of(handle, struct client, handle), op, cqe.res);
+                if (status == -1) return -1;
+            }
+        }
+
+        if (shard->accept_pending) {
+            status = listener_accept(&shard->listener, 0);
+            if (status == -1) return -1;
+        }
+    }
+
+    return 0;
+}
+
+int shard_run(struct shard *shard) {
+    if (shard->config.backend == BACKEND_URING)
+        return shard_run_uring(shard);
+
+    return shard_run_epoll(shard);
+}
+
+static void *shard_thread(void *arg) {
+    struct shard *shard = (struct shard *) arg;
+    char name[LOGNAME];
+    int status;
+
+    snprintf(name, sizeof name, "shard %d", shard->id);
+    status = log_attach(name);
+    if (status == -1)
+        fprintf(stderr, "shard %d: logging synchronously\n", shard->id);
+
+    metrics_attach(shard->id);
+
+    status = shard_run(shard);
+    if (status == -1) {
+        fprintf(stderr, "shard %d failed\n", shard->id);
+        exit(EXIT_FAILURE);
+    }
+
+    return NULL;
+}
+
+int shard_start(struct shard *shard) {
+    sigset_t set, old;
+    int status;
+
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &old);
+
+    status = pthread_create(&shard->thread, NULL, shard_thread, shard);
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (status != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(status));
+        return -1;
+    }
+
+    return 0;
+}
+
+void shard_stop(struct shard *shard) {
+    __atomic_store_n(&shard->running, 0, __ATOMIC_RELEASE);
+    shard_notify(shard);
+}
+
+static void inbox_flush(struct shard *shard) {
+    size_t i;
+
+    for (i = 0; i < shard->backlog_len; i++)
+        if (queue_push(&shard->inbox, &shard->backlog[i]) == -1) break;
+
+    if (i == 0) return;
+
+    memmove(shard->backlog, shard->backlog + i,
+            (shard->backlog_len - i) * sizeof(struct message));
+    shard->backlog_len -= i;
+}
+
+static void inbox_lagged(struct shard *shard) {
+    size_t i, kept = 0;
+
+    for (i = 0; i < shard->backlog_len; i++) {
+        if (shard->backlog[i].packet->data[0] == 1
+            && kept < shard->backlog_cap / 2)
+            shard->backlog[kept++] = shard->backlog[i];
+        else
+            packet_unref(shard->backlog[i].packet);
+    }
+
+    counter_add(&metric_inbox_dropped, shard->backlog_len - kept);
+    log_print(LOG_WARN, "shard=%d lagged, dropped %zu packets and resyncing",
+              shard->id, shard->backlog_len - kept);
+
+    shard->backlog_len = kept;
+}
+
+int shard_publish(struct shard *shard, int feed, struct packet *packet) {
+    struct message message;
+
+    message.feed = feed;
+    message.resync = 0;
+    message.packet = packet_ref(packet);
+    message.time = shard->io->clock();
+
+    inbox_flush(shard);
+    if (shard->backlog_len == 0 && queue_push(&shard->inbox, &message) == 0)
+        return 0;
+
+    if (shard->backlog_len == shard->backlog_cap) {
+        inbox_lagged(shard);
+        message.resync = 1;
+    }
+
+    shard->backlog[shard->backlog_len++] = message;
+    return 0;
+}
+
+int shard_notify(struct shard *shard) {
+    uint64_t value = 1;
+    ssize_t count;
+
+    inbox_flush(shard);
+
+    count = write(shard->inbox_event.fd, &value, 8);
+    if (count != 8 && errno != EAGAIN) {
+        perror("write");
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,207 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+
+#include "slab.h"
+#include "ring.h"
+#include "queue.h"
+#include "packet.h"
+#include "uring.h"
+#include "handoff.h"
+
+#define MAXEVENTS 64
+#define CLIENTSCAPACITY SLAB_CHUNK_SIZE
+
+#define RINGSIZE 128
+#define MAXLAG 64
+#define NOTSENTLOWAT 16384
+#define ACCEPTBATCH 32
+#define WHEELSIZE 64
+#define HANDSHAKETIMEOUT 5
+#define HELLOSTATION 3
+#define IDLETIMEOUT 30
+#define IPSLOTS 65536
+#define MAXPERIP 0
+#define INBOXSIZE 4096
+#define URINGSIZE 1024
+#define ZEROCOPYSLOTS 32
+#define BATCHPACKETS 8
+#define BATCHIOV (2 * BATCHPACKETS)
+#define ZEROCOPYMIN 4096
+
+#ifndef NI_MAXHOST
+#define NI_MAXHOST 1025
+#endif
+
+#ifndef NI_MAXSERV
+#define NI_MAXSERV 32
+#endif
+
+#define container_of(ptr, type, member) \
+    ((type *) ((char *) (ptr) - offsetof(type, member)))
+
+#define CLIENTEVENT 1
+#define CLIENT_EVENT(key) \
+    (SLAB_KEY(SLAB_KEY_GENERATION(key), SLAB_KEY_INDEX(key) << 1) \
+     | CLIENTEVENT)
+#define CLIENT_EVENT_KEY(data) \
+    SLAB_KEY(SLAB_KEY_GENERATION(data), SLAB_KEY_INDEX(data) >> 1)
+
+enum backend {
+    BACKEND_EPOLL,
+    BACKEND_URING
+};
+
+enum policy {
+    POLICY_DROP,
+    POLICY_SKIP,
+    POLICY_SHRINK
+};
+
+struct shard_io {
+    int (*accept4)(int fd, struct sockaddr *addr, socklen_t *len, int flags);
+    ssize_t (*recv)(int fd, void *buf, size_t len, int flags);
+    ssize_t (*recvmsg)(int fd, struct msghdr *msg, int flags);
+    ssize_t (*sendmsg)(int fd, const struct msghdr *msg, int flags);
+    int (*setsockopt)(int fd, int level, int name, const void *value,
+                      socklen_t len);
+    int (*shutdown)(int fd, int how);
+    int (*close)(int fd);
+    int (*epoll_ctl)(int efd, int op, int fd, struct epoll_event *event);
+    uint64_t (*clock)(void);
+};
+
+extern const struct shard_io shard_syscalls;
+
+struct shard_config {
+    enum backend backend;
+    enum policy policy;
+    unsigned int zerocopy: 1;
+    unsigned int burst;
+    unsigned int lag;
+    unsigned int per_ip;
+    uint32_t *ip_counts;
+    const struct shard_io *io;
+};
+
+struct handle {
+    int fd;
+    uint32_t events;
+    int (*handler)(struct handle *handle, uint32_t events);
+};
+
+struct client;
+
+struct feed {
+    const char *name;
+    ring_t ring;
+    struct packet *metadata;
+    uint64_t metadata_seq;
+    uint64_t head;
+    uint64_t resync_seq;
+    int resync;
+
+    uint64_t bytes;
+    uint64_t offsets[RINGSIZE];
+    struct client *waiting[RINGSIZE];
+};
+
+struct message {
+    int feed;
+    int resync;
+    struct packet *packet;
+    uint64_t time;
+};
+
+struct shard {
+    int id;
+    struct shard_config config;
+    const struct shard_io *io;
+
+    int efd;
+    uring_t uring;
+
+    struct handle listener;
+    struct handle inbox_event;
+    struct handle wheel_event;
+    queue_t inbox;
+    struct message *backlog;
+    size_t backlog_len;
+    size_t backlog_cap;
+
+    unsigned int accept_pending: 1;
+    uint64_t now;
+    struct client *wheel[WHEELSIZE];
+
+    slab_t clients;
+    struct feed *feeds;
+    int feeds_len;
+
+    pthread_t thread;
+    int running;
+};
+
+struct client {
+    struct handle handle;
+    struct shard *shard;
+    int feed;
+    unsigned int initialized: 1;
+    unsigned int closing: 1;
+    unsigned int receiving: 1;
+    unsigned int sending: 1;
+    unsigned int zerocopy: 1;
+    unsigned int linked: 1;
+    unsigned int timed: 1;
+    struct packet *metadata;
+    uint64_t cursor;
+    size_t wrote;
+    size_t index;
+
+    uint32_t zerocopy_next;
+    uint32_t zerocopy_done;
+
+    struct client *next;
+    struct client *prev;
+
+    uint32_t ip_slot;
+    uint64_t deadline;
+    uint64_t active;
+    struct client *wheel_next;
+    struct client *wheel_prev;
+};
+
+struct client_cold {
+    char hello[HELLOSIZE];
+    size_t hello_len;
+    char peer[INET6_ADDRSTRLEN];
+    struct packet *zerocopy_pinned[ZEROCOPYSLOTS][BATCHPACKETS];
+    struct packet *inflight[BATCHPACKETS];
+    struct msghdr msg;
+    struct iovec iov[BATCHIOV];
+};
+
+int shard_new(struct shard *shard, int id, int sfd,
+              const struct shard_config *config, const char **feeds,
+              int feeds_len);
+void shard_free(struct shard *shard);
+int shard_advance(struct shard *shard, uint64_t seconds);
+int shard_export(struct shard *shard, int sock);
+int shard_adopt(struct shard *shard, int fd,
+                const struct handoff_client *state, struct packet *backlog);
+void shard_resume(struct shard *shard, int feed, struct packet *metadata);
+int shard_watch(struct shard *shard, struct handle *handle, uint32_t events);
+int shard_dispatch(struct shard *shard, uint64_t data, uint32_t events);
+int shard_run(struct shard *shard);
+int shard_start(struct shard *shard);
+void shard_stop(struct shard *shard);
+
+int shard_publish(struct shard *shard, int feed, struct packet *packet);
+int shard_notify(struct shard *shard);
+
+#endif
@@ -2,171 +2,227 @@
 #include <string.h>
 #include "slab.h"
 
+#define SLAB_ALIGN 16
+#define ALIGN_UP(n) (((n) + SLAB_ALIGN - 1) & ~(size_t) (SLAB_ALIGN - 1))
+
+static struct slab_entry *slab_entry(slab_t *slab, size_t index) {
+    return (struct slab_entry *) (slab->chunks[index >> SLAB_CHUNK_BITS]
+        + (index & (SLAB_CHUNK_SIZE - 1)) * slab->stride);
+}
+
+static void *slab_data(struct slab_entry *entry) {
+    return (char *) entry + ALIGN_UP(sizeof(struct slab_entry));
+}
+
+static int slab_grow(slab_t *slab) {
+    struct slab_entry *entry;
+    char **chunks, *chunk, *cold_chunk = NULL;
+    size_t i, base;
+
+    chunk = (char *) malloc(SLAB_CHUNK_SIZE * slab->stride);
+    if (chunk == NULL) return -1;
+
+    if (slab->cold_size != 0) {
+        cold_chunk = (char *) malloc(SLAB_CHUNK_SIZE * slab->cold_size);
+        if (cold_chunk == NULL) {
+            free(chunk);
+            return -1;
+        }
+    }
+
+    chunks = (char **) realloc(slab->chunks,
+                               (slab->chunks_len + 1) * sizeof(char *));
+    if (chunks == NULL) {
+        free(chunk);
+        free(cold_chunk);
+        return -1;
+    }
+    slab->chunks = chunks;
+
+    if (slab->cold_size != 0) {
+        chunks = (char **) realloc(slab->cold_chunks,
+                                   (slab->chunks_len + 1) * sizeof(char *));
+        if (chunks == NULL) {
+            free(chunk);
+            free(cold_chunk);
+            return -1;
+        }
+        slab->cold_chunks = chunks;
+        slab->cold_chunks[slab->chunks_len] = cold_chunk;
+    }
+
+    slab->chunks[slab->chunks_len] = chunk;
+    slab->chunks_len++;
+
+    base = slab->capacity;
+    slab->capacity += SLAB_CHUNK_SIZE;
+
+    for (i = slab->capacity; i-- > base;) {
+        entry = slab_entry(slab, i);
+        entry->tag = ENTRY_VACANT;
+        entry->generation = 0;
+        entry->prev = -1;
+        entry->next = slab->next;
+        slab->next = i;
+    }
+
+    return 0;
+}
+
 int slab_new(slab_t *slab, size_t capacity, size_t element_size) {
-    slab->entries = (struct slab_entry *) malloc(capacity
-            * (sizeof(struct slab_entry) + element_size));
-    if (slab->entries == NULL) return -1;
+    return slab_new_split(slab, capacity, element_size, 0);
+}
+
+int slab_new_split(slab_t *slab, size_t capacity, size_t element_size,
+                   size_t cold_size)
+{
+    slab->chunks = NULL;
+    slab->cold_chunks = NULL;
+    slab->chunks_len = 0;
 
     slab->element_size = element_size;
+    slab->cold_size = ALIGN_UP(cold_size);
+    slab->stride = ALIGN_UP(sizeof(struct slab_entry)) + ALIGN_UP(element_size);
 
-    slab->capacity = capacity;
+    slab->capacity = 0;
     slab->len = 0;
-    slab->end = 0;
 
-    slab->next = 0;
+    slab->next = -1;
     slab->first = -1;
-    slab->last = -1;
+
+    while (slab->capacity < capacity) {
+        if (slab_grow(slab) == -1) {
+            slab_free(slab);
+            return -1;
+        }
+    }
 
     return 0;
 }
 
 void slab_free(slab_t *slab) {
-    free(slab->entries);
+    size_t i;
 
-    slab->entries = NULL;
+    for (i = 0; i < slab->chunks_len; i++) {
+        free(slab->chunks[i]);
+        if (slab->cold_chunks != NULL)
+            free(slab->cold_chunks[i]);
+    }
+
+    free(slab->chunks);
+    free(slab->cold_chunks);
+
+    slab->chunks = NULL;
+    slab->cold_chunks = NULL;
+    slab->chunks_len = 0;
     slab->element_size = 0;
 
     slab->capacity = 0;
     slab->len = 0;
-    slab->end = 0;
 
-    slab->next = 0;
+    slab->next = -1;
     slab->first = -1;
-    slab->last = -1;
 }
 
 int slab_contains(slab_t *slab, size_t key) {
     struct slab_entry *entry;
+    size_t index = SLAB_KEY_INDEX(key);
 
-    if (key > slab->last) return 0;
+    if (index >= slab->capacity) return 0;
 
-    entry = slab->entries + (sizeof(struct slab_entry) + slab->element_size)
-        * key;
+    entry = slab_entry(slab, index);
     
-    return entry->tag == ENTRY_OCCUPIED;
+    return entry->tag == ENTRY_OCCUPIED
+        && entry->generation == SLAB_KEY_GENERATION(key);
 }
 
 void *slab_get(slab_t *slab, size_t key) {
-    struct slab_entry *entry;
+    if (!slab_contains(slab, key)) return NULL;
 
-    entry = slab->entries + (sizeof(struct slab_entry) + slab->element_size)
-        * key;
-    
-    return entry + sizeof(struct slab_entry);
+    return slab_data(slab_entry(slab, SLAB_KEY_INDEX(key)));
 }
 
-size_t slab_insert(slab_t *slab, const void *element) {
-    struct slab_entry *entry, *last_entry, *next_entry, *prev_entry;
-    size_t next_vacant, index, i;
+void *slab_get_cold(slab_t *slab, size_t key) {
+    size_t index = SLAB_KEY_INDEX(key);
 
-    if (slab->next == slab->capacity) return -1;
-
-    slab->len++;
-    index = slab->next;
-    
-    entry = slab->entries + (sizeof(struct slab_entry) + slab->element_size)
-        * slab->next;
-    
-    next_vacant = entry->next;
-    
-    entry->tag = ENTRY_OCCUPIED;
-    memcpy(entry + sizeof(struct slab_entry), element, slab->element_size);
+    if (slab->cold_size == 0 || !slab_contains(slab, key)) return NULL;
 
-    if (index == slab->end) {
-        if (slab->last != (size_t) -1) {
-            last_entry = slab->entries + (sizeof(struct slab_entry) + slab->element_size)
-                * slab->last;
-            last_entry->next = index;
-        }
+    return slab->cold_chunks[index >> SLAB_CHUNK_BITS]
+        + (index & (SLAB_CHUNK_SIZE - 1)) * slab->cold_size;
+}
 
-        slab->next++;
-        slab->end++;
+size_t slab_insert(slab_t *slab, const void *element) {
+    struct slab_entry *entry;
+    size_t index;
 
-        if (slab->last == (size_t) -1)
-            slab->last = 0;
-        else
-            slab->last++;
-    } else {
-        slab->next = next_vacant; 
-    }
+    if (slab->next == (size_t) -1 && slab_grow(slab) == -1) return -1;
 
-    for (i = index + 1; i <= slab->last && !slab_contains(slab, i); i++);
-    entry->next = slab_contains(slab, i) ? i : (size_t) -1;
+    index = slab->next;
+    entry = slab_entry(slab, index);
 
-    if (entry->next != (size_t) -1) {
-        next_entry = slab->entries + (sizeof(struct slab_entry) + slab->element_size)
-            * entry->next;
-        next_entry->prev = index;
-    }
- 
-    if (index == 0)
-        entry->prev = -1;
-    else {
-        for (i = index - 1; i >= slab->first && !slab_contains(slab, i); i--);
-        entry->prev = i;
-    }
+    slab->next = entry->next;
+    slab->len++;
 
-    if (entry->prev != (size_t) -1) {
-        prev_entry = slab->entries + (sizeof(struct slab_entry) + slab->element_size)
-            * entry->prev;
-        prev_entry->next = index;
-    }
+    entry->tag = ENTRY_OCCUPIED;
+    memcpy(slab_data(entry), element, slab->element_size);
 
-    if (index < slab->first)
-        slab->first = index;
+    entry->prev = -1;
+    entry->next = slab->first;
+    if (slab->first != (size_t) -1)
+        slab_entry(slab, slab->first)->prev = index;
+    slab->first = index;
 
-    return index;
+    return SLAB_KEY(entry->generation, index);
 }
 
 void slab_remove(slab_t *slab, size_t key) {
-    struct slab_entry *entry, *next, *prev;
-    size_t nextnext;
+    struct slab_entry *entry;
+    size_t index = SLAB_KEY_INDEX(key);
 
-    entry = slab->entries + (sizeof(struct slab_entry) + slab->element_size)
-        * key;
-    
-    entry->tag = ENTRY_VACANT;
-    
-    slab->len = slab->len - 1;
-    nextnext = slab->next;
-    slab->next = key;
+    if (!slab_contains(slab, key)) return;
+
+    entry = slab_entry(slab, index);
 
-    if (key == slab->first)
+    if (entry->prev != (size_t) -1)
+        slab_entry(slab, entry->prev)->next = entry->next;
+    else
         slab->first = entry->next;
 
-    if (entry->prev != (size_t) -1) {
-        prev = slab->entries + (sizeof(struct slab_entry) + slab->element_size)
-            * entry->prev;
-        prev->next = entry->next;
-    }
-    
-    if (entry->next != (size_t) -1) {
-        next = slab->entries + (sizeof(struct slab_entry) + slab->element_size)
-            * entry->next;
-        next->prev = entry->prev;
-    }
+    if (entry->next != (size_t) -1)
+        slab_entry(slab, entry->next)->prev = entry->prev;
+
+    entry->tag = ENTRY_VACANT;
+    entry->generation++;
+    entry->prev = -1;
+    entry->next = slab->next;
+    slab->next = index;
 
-    entry->next = nextnext;
+    slab->len--;
 }
 
-void slab_iter_create(slab_t *slab, slab_iter_t *iter) {
+static void slab_iter_load(slab_t *slab, slab_iter_t *iter, size_t index) {
     struct slab_entry *entry;
 
-    if (slab->first == (size_t) -1) {
-        iter->prev_index = -1;
+    if (index == (size_t) -1) {
         iter->index = -1;
         iter->next_index = -1;
+        iter->prev_index = -1;
+        iter->key = -1;
         iter->data = NULL;
         return;
     }
 
-    entry = slab->entries + (sizeof(struct slab_entry) + slab->element_size)
-        * slab->first;
+    entry = slab_entry(slab, index);
 
-    iter->index = slab->first;
+    iter->index = index;
     iter->next_index = entry->next;
     iter->prev_index = entry->prev;
-    iter->data = entry + sizeof(struct slab_entry);
+    iter->key = SLAB_KEY(entry->generation, index);
+    iter->data = slab_data(entry);
+}
+
+void slab_iter_create(slab_t *slab, slab_iter_t *iter) {
+    slab_iter_load(slab, iter, slab->first);
 }
 
 int slab_iter_done(slab_iter_t *iter) {
@@ -174,21 +230,5 @@ int slab_iter_done(slab_iter_t *iter) {
 }
 
 void slab_iter_next(slab_t *slab, slab_iter_t *iter) {
-    struct slab_entry *entry;
-
-    if (iter->next_index == (size_t) -1) {
-        iter->index = -1;
-        iter->next_index = -1;
-        iter->prev_index = -1;
-        iter->data = NULL;
-    } else {
-        entry = slab->entries + (sizeof(struct slab_entry) + slab->element_size)
-            * iter->next_index;
-
-        iter->prev_index = entry->prev;
-        iter->index = iter->next_index;
-        iter->next_index = entry->next;
-        iter->data = entry + sizeof(struct slab_entry);
-    }
+    slab_iter_load(slab, iter, iter->next_index);
 }
-
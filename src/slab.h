@@ -2,6 +2,15 @@
 #define SLAB_H
 
 #include <stdlib.h>
+#include <stdint.h>
+
+#define SLAB_CHUNK_BITS 8
+#define SLAB_CHUNK_SIZE (1 << SLAB_CHUNK_BITS)
+
+#define SLAB_KEY(generation, index) \
+    (((size_t) (generation) << 32) | (size_t) (index))
+#define SLAB_KEY_INDEX(key) ((key) & 0xffffffff)
+#define SLAB_KEY_GENERATION(key) ((key) >> 32)
 
 enum slab_entry_tag {
     ENTRY_OCCUPIED,
@@ -10,35 +19,43 @@ enum slab_entry_tag {
 
 struct slab_entry {
     enum slab_entry_tag tag;
+    uint32_t generation;
     size_t next;
     size_t prev;
 };
 
 typedef struct slab {
-    struct slab_entry *entries;
+    char **chunks;
+    char **cold_chunks;
+    size_t chunks_len;
+
     size_t element_size;
+    size_t cold_size;
+    size_t stride;
 
     size_t capacity;
     size_t len;
-    size_t end;
 
     size_t next;
     size_t first;
-    size_t last;
 } slab_t;
 
 typedef struct slab_iter {
     size_t index;
     size_t next_index;
     size_t prev_index;
+    size_t key;
     void *data;
 } slab_iter_t;
 
 
 int slab_new(slab_t *slab, size_t capacity, size_t element_size);
+int slab_new_split(slab_t *slab, size_t capacity, size_t element_size,
+                   size_t cold_size);
 void slab_free(slab_t *slab);
 int slab_contains(slab_t *slab, size_t key);
 void *slab_get(slab_t *slab, size_t key);
+void *slab_get_cold(slab_t *slab, size_t key);
 size_t slab_insert(slab_t *slab, const void *element);
 void slab_remove(slab_t *slab, size_t key);
 
@@ -47,4 +64,3 @@ int slab_iter_done(slab_iter_t *iter);
 void slab_iter_next(slab_t *slab, slab_iter_t *iter);
 
 #endif
-
@@ -0,0 +1,425 @@
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <libgen.h>
+
+#include "rip.h"
+#include "packet.h"
+#include "queue.h"
+#include "track.h"
+#include "loader.h"
+#include "library.h"
+#include "ripx.h"
+#include "station.h"
+#include "log.h"
+
+static int load_playlist(struct library *library, char ***out) {
+    const char *name;
+    size_t dir_path_len = strlen(library->dir_path), len;
+    uint32_t i;
+
+    if (library->count == 0) {
+        fprintf(stderr, "empty playlist\n");
+        return -1;
+    }
+
+    *out = (char **) malloc(library->count * sizeof(char *));
+    if (*out == NULL) return -1;
+
+    for (i = 0; i < library->count; i++) {
+        name = library_string(library, library->entries[i].path);
+        len = strlen(name);
+
+        (*out)[i] = (char *) malloc(dir_path_len + len + 2);
+        if ((*out)[i] == NULL) return -1;
+
+        memcpy((*out)[i], library->dir_path, dir_path_len);
+        (*out)[i][dir_path_len] = '/';
+        memcpy((*out)[i] + dir_path_len + 1, name, len + 1);
+    }
+
+    return library->count;
+}
+
+static struct track *station_track(struct station *station, int song) {
+    if (station->archive != NULL)
+        return track_new_archived(station->archive, song);
+
+    return track_new(station->playlist[song]);
+}
+
+static int station_open(struct station *station, char *path) {
+    char *dot = strrchr(path, '.');
+    int status;
+
+    if (dot == NULL || strcmp(dot, ".ripx") != 0) {
+        status = library_open(&station->library, path);
+        if (status == -1) return -1;
+
+        station->playlist_size = load_playlist(&station->library,
+                                               &station->playlist);
+        return station->playlist_size;
+    }
+
+    *strrchr(station->name, '.') = 0;
+
+    station->archive = (struct ripx *) malloc(sizeof(struct ripx));
+    if (station->archive == NULL) return -1;
+
+    status = ripx_open(station->archive, path);
+    if (status == -1) return -1;
+
+    if (station->archive->count == 0) {
+        fprintf(stderr, "empty playlist\n");
+        return -1;
+    }
+
+    station->playlist_size = station->archive->count;
+    return station->playlist_size;
+}
+
+static void station_prefetch(struct station *station) {
+    struct track *track;
+    int song, status;
+
+    if (station->playlist_size == 0) return;
+
+    while (station->prefetching < PREFETCH) {
+        song = (station->prefetch_song + 1) % station->playlist_size;
+
+        track = station_track(station, song);
+        if (track == NULL) return;
+
+        status = loader_submit(station->loader, JOB_LOAD, track,
+                               &station->ready);
+        if (status == -1) {
+            track_free(track);
+            return;
+        }
+
+        station->prefetch_song = song;
+        station->prefetching++;
+    }
+}
+
+static void station_announce(struct station *station) {
+    const struct rip_metadata *metadata = &station->track->map->metadata;
+
+    log_print(LOG_INFO, "station=%s current song: %.*s (%.*s) - %.*s [%u cs]",
+              station->name, metadata->artist.len, metadata->artist.data,
+              metadata->album.len, metadata->album.data, metadata->name.len,
+              metadata->name.data, metadata->length);
+}
+
+static int station_find(struct station *station, const char *path,
+                        int *found)
+{
+    int low = 0, high = station->playlist_size, mid, cmp;
+
+    *found = 0;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        cmp = strcmp(station->playlist[mid], path);
+        if (cmp == 0) {
+            *found = 1;
+            return mid;
+        }
+
+        if (cmp < 0) low = mid + 1;
+        else high = mid;
+    }
+
+    return low;
+}
+
+static int station_song(struct station *station,
+                        const struct track *track)
+{
+    int i, found;
+
+    if (station->archive != NULL) return track->index;
+
+    i = station_find(station, track->path, &found);
+    return found ? i : -1;
+}
+
+static int station_next(struct station *station) {
+    struct track *track;
+    int song;
+
+    while (queue_pop(&station->ready, &track) == 0) {
+        station->prefetching--;
+
+        song = station_song(station, track);
+        if (track->failed || song == -1 || track_stale(track)) {
+            log_print(LOG_WARN, "station=%s skipping %s", station->name,
+                      track->path);
+            loader_submit(station->loader, JOB_FREE, track, NULL);
+            continue;
+        }
+
+        loader_submit(station->loader, JOB_FREE, station->track, NULL);
+        station->track = track;
+        station->current_song = song;
+        station->offset = 0;
+
+        station_announce(station);
+
+        station_prefetch(station);
+        return 0;
+    }
+
+    station_prefetch(station);
+    return -1;
+}
+
+int station_new(struct station *station, int id, char *dir_path,
+                struct loader *loader)
+{
+    char *path;
+    int status;
+
+    memset(station, 0, sizeof(struct station));
+    station->id = id;
+    station->loader = loader;
+
+    path = strdup(dir_path);
+    if (path == NULL) return -1;
+
+    station->name = strdup(basename(path));
+    free(path);
+    if (station->name == NULL) return -1;
+
+    status = station_open(station, dir_path);
+    if (status == -1) return -1;
+
+    log_print(LOG_INFO, "station=%s playlist loaded (%d songs)",
+              station->name, station->playlist_size);
+
+    status = queue_new(&station->ready, PREFETCH, sizeof(struct track *));
+    if (status == -1) return -1;
+
+    station->track = station_track(station, 0);
+    if (station->track == NULL) return -1;
+
+    status = track_load(station->track, loader->cache);
+    if (status == -1) return -1;
+
+    station_announce(station);
+
+    station_prefetch(station);
+
+    return 0;
+}
+
+int station_seek(struct station *station, int song, size_t offset) {
+    size_t tick = (size_t) station->loader->cache->interval * BYTERATE / 1000;
+    struct track *track;
+
+    if (song < 0 || song >= station->playlist_size) return -1;
+
+    while (station->prefetching > 0) {
+        if (queue_pop(&station->ready, &track) == -1) {
+            nanosleep(&(struct timespec){0, 1000000}, NULL);
+            continue;
+        }
+
+        station->prefetching--;
+        loader_submit(station->loader, JOB_FREE, track, NULL);
+    }
+
+    if (song != station->current_song) {
+        track = station_track(station, song);
+        if (track == NULL) return -1;
+
+        if (track_load(track, station->loader->cache) == -1) {
+            track_free(track);
+            return -1;
+        }
+
+        loader_submit(station->loader, JOB_FREE, station->track, NULL);
+        station->track = track;
+        station->current_song = song;
+
+        station_announce(station);
+    }
+
+    if (offset > station->track->map->metadata.size)
+        offset = station->track->map->metadata.size;
+    offset -= offset % tick;
+
+    station->offset = offset;
+    station->prefetch_song = song;
+    station_prefetch(station);
+
+    return 0;
+}
+
+void station_free(struct station *station) {
+    struct track *track;
+    int i;
+
+    if (station->playlist != NULL) {
+        for (i = 0; i < station->playlist_size; i++)
+            free(station->playlist[i]);
+        free(station->playlist);
+    }
+
+    while (queue_pop(&station->ready, &track) == 0)
+        track_free(track);
+    queue_free(&station->ready);
+
+    track_free(station->track);
+    library_free(&station->library);
+
+    if (station->archive != NULL) {
+        ripx_free(station->archive);
+        free(station->archive);
+    }
+
+    free(station->name);
+}
+
+static char *station_path(struct station *station, const char *name) {
+    char *path;
+
+    path = (char *) malloc(strlen(station->library.dir_path)
+                           + strlen(name) + 2);
+    if (path == NULL) return NULL;
+
+    sprintf(path, "%s/%s", station->library.dir_path, name);
+    return path;
+}
+
+int station_add(struct station *station, const char *name) {
+    char **playlist, *path;
+    int i, found;
+
+    path = station_path(station, name);
+    if (path == NULL) return -1;
+
+    i = station_find(station, path, &found);
+    if (found) {
+        free(path);
+        return 0;
+    }
+
+    playlist = (char **) realloc(station->playlist,
+                                 (station->playlist_size + 1)
+                                 * sizeof(char *));
+    if (playlist == NULL) {
+        free(path);
+        return -1;
+    }
+
+    memmove(playlist + i + 1, playlist + i,
+            (station->playlist_size - i) * sizeof(char *));
+    playlist[i] = path;
+
+    station->playlist = playlist;
+    station->playlist_size++;
+
+    if (i <= station->current_song) station->current_song++;
+    if (i <= station->prefetch_song) station->prefetch_song++;
+
+    log_print(LOG_INFO, "station=%s added %s (%d songs)", station->name,
+              name, station->playlist_size);
+
+    station_prefetch(station);
+    return 0;
+}
+
+int station_changed(struct station *station, const char *name) {
+    struct track *track = station->track;
+    char *path;
+    int current;
+
+    path = station_path(station, name);
+    if (path == NULL) return -1;
+
+    cache_invalidate(station->loader->cache, path);
+
+    current = strcmp(track->path, path) == 0;
+    free(path);
+
+    if (!current || !track_stale(track)) return 0;
+
+    log_print(LOG_WARN, "station=%s %s changed on disk, skipping",
+              station->name, name);
+
+    station->offset = track->map->metadata.size;
+    return 0;
+}
+
+int station_remove(struct station *station, const char *name) {
+    char *path;
+    int i, found;
+
+    path = station_path(station, name);
+    if (path == NULL) return -1;
+
+    cache_invalidate(station->loader->cache, path);
+
+    i = station_find(station, path, &found);
+    free(path);
+    if (!found) return 0;
+
+    free(station->playlist[i]);
+    memmove(station->playlist + i, station->playlist + i + 1,
+            (station->playlist_size - i - 1) * sizeof(char *));
+    station->playlist_size--;
+
+    if (i == station->current_song)
+        station->offset = station->track->map->metadata.size;
+    if (i <= station->current_song && station->current_song > 0)
+        station->current_song--;
+    if (i <= station->prefetch_song) station->prefetch_song--;
+
+    log_print(LOG_INFO, "station=%s removed %s (%d songs)", station->name,
+              name, station->playlist_size);
+
+    return 0;
+}
+
+int station_tick(struct station *station, struct packet **out, int max) {
+    struct track *track = station->track;
+    size_t tick = (size_t) track->cache->interval * BYTERATE / 1000;
+    size_t left = tick, len;
+    int n = 0;
+
+    if (station->debt >= tick) {
+        station->debt -= tick;
+        return 0;
+    }
+
+    while (left > 0 && n < max) {
+        track = station->track;
+        len = track->map->metadata.size - station->offset;
+
+        if (len == 0) {
+            if (station_next(station) == -1) break;
+
+            out[n++] = packet_ref(station->track->metadata_packet);
+            continue;
+        }
+
+        if (len > tick) len = tick;
+
+        out[n++] = packet_ref(track->entry->frames[station->offset / tick]);
+        station->offset += len;
+
+        if (len > left) {
+            station->debt += len - left;
+            len = left;
+        }
+        left -= len;
+    }
+
+    return n;
+}
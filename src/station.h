@@ -0,0 +1,48 @@
+#ifndef STATION_H
+#define STATION_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "rip.h"
+#include "packet.h"
+#include "queue.h"
+#include "track.h"
+#include "loader.h"
+#include "library.h"
+#include "ripx.h"
+
+#define MAXTICKPACKETS 8
+#define PREFETCH 2
+
+struct station {
+    int id;
+    char *name;
+
+    struct library library;
+    struct ripx *archive;
+    int watch;
+    char **playlist;
+    int playlist_size;
+    int current_song;
+    int prefetch_song;
+    int prefetching;
+
+    struct loader *loader;
+    queue_t ready;
+
+    struct track *track;
+    size_t offset;
+    size_t debt;
+};
+
+int station_new(struct station *station, int id, char *dir_path,
+                struct loader *loader);
+void station_free(struct station *station);
+int station_seek(struct station *station, int song, size_t offset);
+int station_add(struct station *station, const char *name);
+int station_remove(struct station *station, const char *name);
+int station_changed(struct station *station, const char *name);
+int station_tick(struct station *station, struct packet **out, int max);
+
+#endif
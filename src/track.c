@@ -0,0 +1,139 @@
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rip.h"
+#include "packet.h"
+#include "ripx.h"
+#include "cache.h"
+#include "track.h"
+
+struct track *track_new(const char *path) {
+    struct track *track;
+
+    track = (struct track *) calloc(1, sizeof(struct track));
+    if (track == NULL) return NULL;
+
+    track->path = strdup(path);
+    if (track->path == NULL) {
+        free(track);
+        return NULL;
+    }
+
+    return track;
+}
+
+struct track *track_new_archived(struct ripx *archive, uint32_t index) {
+    struct track *track;
+    size_t len = strlen(archive->path) + 12;
+    char *path;
+
+    path = (char *) malloc(len);
+    if (path == NULL) return NULL;
+
+    snprintf(path, len, "%s#%u", archive->path, index);
+
+    track = track_new(path);
+    free(path);
+    if (track == NULL) return NULL;
+
+    track->archive = archive;
+    track->index = index;
+
+    return track;
+}
+
+static int track_open_archived(struct track *track, struct rip_map **map,
+                               struct packet **metadata)
+{
+    const char *packet;
+    size_t len;
+
+    *map = ripx_track(track->archive, track->index);
+    if (*map == NULL) return -1;
+
+    packet = ripx_metadata_packet(track->archive, track->index, &len);
+
+    *metadata = packet_new(len);
+    if (*metadata == NULL) {
+        rip_map_unref(*map);
+        return -1;
+    }
+
+    memcpy((*metadata)->data, packet, len);
+
+    return 0;
+}
+
+static int track_open(struct track *track, struct rip_map **map,
+                      struct packet **metadata)
+{
+    if (track->archive != NULL)
+        return track_open_archived(track, map, metadata);
+
+    *map = rip_map_open(track->path);
+    if (*map == NULL) return -1;
+
+    *metadata = packet_new(rip_metadata_size(&(*map)->metadata));
+    if (*metadata == NULL) {
+        rip_map_unref(*map);
+        return -1;
+    }
+
+    rip_encode_metadata(&(*map)->metadata, (*metadata)->data);
+
+    return 0;
+}
+
+int track_load(struct track *track, struct cache *cache) {
+    struct cache_entry *entry;
+    struct packet *metadata;
+    struct rip_map *map;
+    int status;
+
+    track->failed = 1;
+    track->cache = cache;
+
+    entry = cache_lookup(cache, track->path);
+    if (entry != NULL && track->archive == NULL
+        && rip_map_stale(entry->map, track->path))
+    {
+        cache_invalidate(cache, track->path);
+        cache_release(cache, entry);
+        entry = NULL;
+    }
+
+    if (entry == NULL) {
+        status = track_open(track, &map, &metadata);
+        if (status == -1) return -1;
+
+        entry = cache_insert(cache, track->path, map, metadata);
+        if (entry == NULL) return -1;
+    }
+
+    track->entry = entry;
+    track->map = entry->map;
+    track->metadata_packet = entry->metadata;
+    track->failed = 0;
+
+    return 0;
+}
+
+int track_stale(const struct track *track) {
+    if (track->map == NULL) return 1;
+    if (track->archive != NULL) return 0;
+
+    return rip_map_stale(track->map, track->path);
+}
+
+void track_free(struct track *track) {
+    if (track == NULL) return;
+
+    if (track->entry != NULL)
+        cache_release(track->cache, track->entry);
+
+    free(track->path);
+    free(track);
+}
@@ -0,0 +1,26 @@
+#ifndef TRACK_H
+#define TRACK_H
+
+#include "rip.h"
+#include "packet.h"
+#include "ripx.h"
+#include "cache.h"
+
+struct track {
+    char *path;
+    struct ripx *archive;
+    uint32_t index;
+    struct cache *cache;
+    struct cache_entry *entry;
+    struct rip_map *map;
+    struct packet *metadata_packet;
+    unsigned int failed: 1;
+};
+
+struct track *track_new(const char *path);
+struct track *track_new_archived(struct ripx *archive, uint32_t index);
+int track_load(struct track *track, struct cache *cache);
+int track_stale(const struct track *track);
+void track_free(struct track *track);
+
+#endif
@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned wait,
+                       unsigned flags)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, submit, wait, flags,
+                         NULL, 0);
+}
+
+int uring_new(uring_t *uring, unsigned entries) {
+    struct io_uring_params params;
+    char *sq, *cq;
+
+    memset(&params, 0, sizeof params);
+
+    uring->fd = uring_setup(entries, &params);
+    if (uring->fd == -1) {
+        perror("io_uring_setup");
+        return -1;
+    }
+
+    uring->sq_ring_size = params.sq_off.array
+        + params.sq_entries * sizeof(unsigned);
+    uring->cq_ring_size = params.cq_off.cqes
+        + params.cq_entries * sizeof(struct io_uring_cqe);
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    uring->sq_ring = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, uring->fd,
+                          IORING_OFF_SQ_RING);
+    if (uring->sq_ring == MAP_FAILED) {
+        perror("mmap");
+        close(uring->fd);
+        return -1;
+    }
+
+    uring->cq_ring = mmap(NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, uring->fd,
+                          IORING_OFF_CQ_RING);
+    if (uring->cq_ring == MAP_FAILED) {
+        perror("mmap");
+        munmap(uring->sq_ring, uring->sq_ring_size);
+        close(uring->fd);
+        return -1;
+    }
+
+    uring->sqes = (struct io_uring_sqe *) mmap(NULL, uring->sqes_size,
+                                               PROT_READ | PROT_WRITE,
+                                               MAP_SHARED | MAP_POPULATE,
+                                               uring->fd, IORING_OFF_SQES);
+    if (uring->sqes == MAP_FAILED) {
+        perror("mmap");
+        munmap(uring->cq_ring, uring->cq_ring_size);
+        munmap(uring->sq_ring, uring->sq_ring_size);
+        close(uring->fd);
+        return -1;
+    }
+
+    sq = (char *) uring->sq_ring;
+    uring->sq_head = (unsigned *) (sq + params.sq_off.head);
+    uring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    uring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    uring->sq_array = (unsigned *) (sq + params.sq_off.array);
+
+    cq = (char *) uring->cq_ring;
+    uring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    uring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    uring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    uring->pending = 0;
+
+    return 0;
+}
+
+void uring_free(uring_t *uring) {
+    munmap(uring->sqes, uring->sqes_size);
+    munmap(uring->cq_ring, uring->cq_ring_size);
+    munmap(uring->sq_ring, uring->sq_ring_size);
+    close(uring->fd);
+
+    uring->fd = -1;
+    uring->pending = 0;
+}
+
+struct io_uring_sqe *uring_sqe(uring_t *uring) {
+    struct io_uring_sqe *sqe;
+    unsigned head, tail, index;
+
+    head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+    tail = *uring->sq_tail;
+
+    if (tail - head > *uring->sq_mask) {
+        if (uring_submit(uring, 0) == -1) return NULL;
+
+        head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head > *uring->sq_mask) return NULL;
+    }
+
+    index = tail & *uring->sq_mask;
+    sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof *sqe);
+
+    uring->sq_array[index] = index;
+    __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    uring->pending++;
+
+    return sqe;
+}
+
+int uring_submit(uring_t *uring, unsigned wait) {
+    int status;
+
+    do {
+        status = uring_enter(uring->fd, uring->pending, wait,
+                             wait ? IORING_ENTER_GETEVENTS : 0);
+    } while (status == -1 && errno == EINTR && uring->pending > 0);
+
+    if (status == -1) {
+        if (errno == EINTR) return -1;
+        if (errno == EAGAIN || errno == EBUSY) return 0;
+        perror("io_uring_enter");
+        return -1;
+    }
+
+    uring->pending -= status;
+
+    return status;
+}
+
+int uring_cqe(uring_t *uring, struct io_uring_cqe *cqe) {
+    unsigned head, tail;
+
+    head = *uring->cq_head;
+    tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+    if (head == tail) return -1;
+
+    *cqe = uring->cqes[head & *uring->cq_mask];
+    __atomic_store_n(uring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
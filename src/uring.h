@@ -0,0 +1,37 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+typedef struct uring {
+    int fd;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    void *cq_ring;
+    size_t cq_ring_size;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    unsigned pending;
+} uring_t;
+
+int uring_new(uring_t *uring, unsigned entries);
+void uring_free(uring_t *uring);
+struct io_uring_sqe *uring_sqe(uring_t *uring);
+int uring_submit(uring_t *uring, unsigned wait);
+int uring_cqe(uring_t *uring, struct io_uring_cqe *cqe);
+
+#endif
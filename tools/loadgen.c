@@ -0,0 +1,522 @@
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+
+#define TICK 250
+#define WARMUP 2
+#define MAXEVENTS 256
+#define READSIZE 65536
+#define MAXDATA (1 << 20)
+#define REFILL 10000000
+
+enum state {
+    EXPECT_TYPE,
+    META_TOTAL,
+    META_LEN,
+    META_STR,
+    DATA_HEAD,
+    DATA_BODY
+};
+
+struct conn {
+    int fd;
+    unsigned int connected: 1;
+    unsigned int closed: 1;
+    unsigned int slow: 1;
+    unsigned int paused: 1;
+    unsigned int timed: 1;
+
+    enum state state;
+    uint8_t field[8];
+    unsigned int field_len;
+    unsigned int field_need;
+    unsigned int strings;
+    uint32_t skip;
+    uint32_t time;
+
+    uint64_t started;
+    uint64_t first_audio;
+    uint64_t last_data;
+    double tokens;
+};
+
+struct loadgen {
+    int efd;
+    struct sockaddr_in addr;
+    const char *station;
+    int sources;
+    int connections;
+    double slow;
+    double slow_rate;
+    uint64_t interval;
+
+    struct conn *conns;
+    int opened;
+
+    uint64_t bytes;
+    uint64_t packets;
+    uint64_t metadata;
+    uint64_t framing_errors;
+    uint64_t order_errors;
+    uint64_t failed;
+    uint64_t dropped;
+
+    struct histogram first_audio;
+    struct histogram gap;
+    struct histogram jitter;
+};
+
+const char* const USAGE =
+    "usage: %s [-c connections] [-d duration s] [-r connects per s] "
+    "[-s station] [-t tick ms] [-S slow fraction] [-R slow bytes per s] "
+    "[-a source addresses] [-h host] <port>\n";
+
+static uint32_t read_u32(const uint8_t *buf) {
+    return (uint32_t) buf[0] << 24 | (uint32_t) buf[1] << 16
+        | (uint32_t) buf[2] << 8 | buf[3];
+}
+
+static void conn_close(struct loadgen *lg, struct conn *conn, int failed) {
+    if (conn->closed) return;
+
+    close(conn->fd);
+    conn->closed = 1;
+
+    if (failed) lg->failed++;
+    else lg->dropped++;
+}
+
+static void conn_data(struct loadgen *lg, struct conn *conn, uint64_t now) {
+    uint64_t gap;
+
+    lg->packets++;
+
+    if (conn->first_audio == 0) {
+        conn->first_audio = now;
+        histogram_observe(&lg->first_audio, now - conn->started);
+    } else if (now - conn->first_audio >= WARMUP * 1000000000ULL) {
+        gap = now - conn->last_data;
+        histogram_observe(&lg->gap, gap);
+        histogram_observe(&lg->jitter, gap > lg->interval
+                          ? gap - lg->interval : lg->interval - gap);
+    }
+
+    conn->last_data = now;
+}
+
+static int conn_parse(struct loadgen *lg, struct conn *conn,
+                      const uint8_t *buf, size_t len, uint64_t now)
+{
+    size_t n;
+    uint32_t time;
+
+    while (len > 0 || (conn->skip == 0
+                       && (conn->state == META_STR
+                           || conn->state == DATA_BODY)))
+    {
+        switch (conn->state) {
+        case EXPECT_TYPE:
+            conn->field_len = 0;
+            if (buf[0] == 1) {
+                conn->state = META_TOTAL;
+                conn->field_need = 4;
+                conn->strings = 0;
+            } else if (buf[0] == 2) {
+                conn->state = DATA_HEAD;
+                conn->field_need = 8;
+            } else {
+                return -1;
+            }
+            buf++;
+            len--;
+            break;
+
+        case META_TOTAL:
+        case META_LEN:
+        case DATA_HEAD:
+            n = conn->field_need - conn->field_len;
+            if (n > len) n = len;
+            memcpy(conn->field + conn->field_len, buf, n);
+            conn->field_len += n;
+            buf += n;
+            len -= n;
+
+            if (conn->field_len < conn->field_need) break;
+            conn->field_len = 0;
+
+            if (conn->state == META_TOTAL) {
+                conn->state = META_LEN;
+                conn->field_need = 2;
+            } else if (conn->state == META_LEN) {
+                conn->skip = (uint32_t) conn->field[0] << 8 | conn->field[1];
+                conn->state = META_STR;
+            } else {
+                conn->skip = read_u32(conn->field);
+                time = read_u32(conn->field + 4);
+                if (conn->skip > MAXDATA) return -1;
+
+                if (conn->timed && time <= conn->time)
+                    lg->order_errors++;
+
+                conn->time = time;
+                conn->timed = 1;
+                conn->state = DATA_BODY;
+            }
+            break;
+
+        case META_STR:
+        case DATA_BODY:
+            n = conn->skip < len ? conn->skip : len;
+            conn->skip -= n;
+            buf += n;
+            len -= n;
+
+            if (conn->skip > 0) break;
+
+            if (conn->state == DATA_BODY) {
+                conn_data(lg, conn, now);
+                conn->state = EXPECT_TYPE;
+            } else if (++conn->strings == 3) {
+                lg->metadata++;
+                conn->timed = 0;
+                conn->state = EXPECT_TYPE;
+            } else {
+                conn->state = META_LEN;
+                conn->field_need = 2;
+            }
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static int conn_watch(struct loadgen *lg, struct conn *conn, int op,
+                      uint32_t events)
+{
+    struct epoll_event event;
+
+    event.data.ptr = conn;
+    event.events = events;
+
+    if (epoll_ctl(lg->efd, op, conn->fd, &event) == -1) {
+        perror("epoll_ctl");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int conn_open(struct loadgen *lg, struct conn *conn, int index,
+                     uint64_t now)
+{
+    struct sockaddr_in source;
+    int status;
+
+    memset(conn, 0, sizeof *conn);
+    conn->started = now;
+    conn->slow = lg->slow > 0 && (double) (index % 1000) < lg->slow * 1000;
+
+    conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (conn->fd == -1) {
+        perror("socket");
+        conn->closed = 1;
+        lg->failed++;
+        return 0;
+    }
+
+    if (lg->sources > 1) {
+        memset(&source, 0, sizeof source);
+        source.sin_family = AF_INET;
+        source.sin_addr.s_addr = htonl(0x7f010000u + index % lg->sources);
+
+        status = bind(conn->fd, (struct sockaddr *) &source, sizeof source);
+        if (status == -1) perror("bind");
+    }
+
+    if (conn->slow)
+        setsockopt(conn->fd, SOL_SOCKET, SO_RCVBUF, &(int){4096},
+                   sizeof(int));
+
+    status = connect(conn->fd, (struct sockaddr *) &lg->addr,
+                     sizeof lg->addr);
+    if (status == -1 && errno != EINPROGRESS) {
+        perror("connect");
+        conn_close(lg, conn, 1);
+        return 0;
+    }
+
+    return conn_watch(lg, conn, EPOLL_CTL_ADD, EPOLLOUT);
+}
+
+static int conn_connected(struct loadgen *lg, struct conn *conn) {
+    char hello[2 + 255];
+    size_t len = 1;
+    socklen_t optlen = sizeof(int);
+    int error = 0;
+
+    getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &optlen);
+    if (error != 0) {
+        conn_close(lg, conn, 1);
+        return 0;
+    }
+
+    hello[0] = 0;
+    if (lg->station != NULL) {
+        hello[0] = 3;
+        len = strlen(lg->station);
+        hello[1] = len;
+        memcpy(hello + 2, lg->station, len);
+        len += 2;
+    }
+
+    if (send(conn->fd, hello, len, MSG_NOSIGNAL) != (ssize_t) len) {
+        conn_close(lg, conn, 1);
+        return 0;
+    }
+
+    conn->connected = 1;
+    conn->tokens = lg->slow_rate;
+
+    return conn_watch(lg, conn, EPOLL_CTL_MOD, EPOLLIN);
+}
+
+static int conn_read(struct loadgen *lg, struct conn *conn, uint8_t *buf,
+                     uint64_t now)
+{
+    size_t want = READSIZE;
+    ssize_t count;
+
+    if (conn->slow) {
+        if (conn->tokens < 1) {
+            conn->paused = 1;
+            return conn_watch(lg, conn, EPOLL_CTL_MOD, 0);
+        }
+        if (conn->tokens < want) want = conn->tokens;
+    }
+
+    count = recv(conn->fd, buf, want, 0);
+    if (count == -1 && (errno == EAGAIN || errno == EINTR)) return 0;
+    if (count <= 0) {
+        conn_close(lg, conn, 0);
+        return 0;
+    }
+
+    lg->bytes += count;
+    if (conn->slow) conn->tokens -= count;
+
+    if (conn_parse(lg, conn, buf, count, now) == -1) {
+        lg->framing_errors++;
+        conn_close(lg, conn, 0);
+    }
+
+    return 0;
+}
+
+static int refill(struct loadgen *lg, double seconds) {
+    struct conn *conn;
+    int i;
+
+    for (i = 0; i < lg->opened; i++) {
+        conn = &lg->conns[i];
+        if (!conn->slow || conn->closed || !conn->connected) continue;
+
+        conn->tokens += lg->slow_rate * seconds;
+        if (conn->tokens > lg->slow_rate) conn->tokens = lg->slow_rate;
+
+        if (conn->paused && conn->tokens >= 1) {
+            conn->paused = 0;
+            if (conn_watch(lg, conn, EPOLL_CTL_MOD, EPOLLIN) == -1)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void report(struct loadgen *lg, double seconds) {
+    static const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+    static const char *const NAMES[] = {"p50", "p90", "p99", "p999"};
+    const struct histogram *histograms[] = {
+        &lg->first_audio, &lg->gap, &lg->jitter
+    };
+    static const char *const LABELS[] = {"first_audio", "gap", "jitter"};
+    int i, j, open = 0;
+
+    for (i = 0; i < lg->opened; i++)
+        if (!lg->conns[i].closed && lg->conns[i].connected) open++;
+
+    printf("connections %d open %d failed %llu dropped %llu\n", lg->opened,
+           open, (unsigned long long) lg->failed,
+           (unsigned long long) lg->dropped);
+    printf("bytes %llu packets %llu metadata %llu\n",
+           (unsigned long long) lg->bytes, (unsigned long long) lg->packets,
+           (unsigned long long) lg->metadata);
+    printf("throughput %.3f MB/s %.1f packets/s\n",
+           lg->bytes / seconds / 1e6, lg->packets / seconds);
+    printf("errors framing %llu order %llu\n",
+           (unsigned long long) lg->framing_errors,
+           (unsigned long long) lg->order_errors);
+
+    for (i = 0; i < 3; i++) {
+        printf("%s_ms", LABELS[i]);
+        for (j = 0; j < 4; j++)
+            printf(" %s %.3f", NAMES[j],
+                   histogram_quantile(histograms[i], QUANTILES[j]) / 1e6);
+        printf(" count %llu\n",
+               (unsigned long long) histogram_count(histograms[i]));
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct epoll_event events[MAXEVENTS];
+    struct loadgen lg;
+    struct rlimit limit;
+    const char *host = "127.0.0.1";
+    uint64_t start, end, now, last_refill;
+    double duration = 10, rate = 0;
+    uint8_t *buf;
+    int opt, n, i, status, tick = TICK;
+    struct conn *conn;
+
+    memset(&lg, 0, sizeof lg);
+    lg.connections = 100;
+    lg.sources = 1;
+    lg.slow_rate = 1024;
+
+    while ((opt = getopt(argc, argv, "c:d:r:s:t:S:R:a:h:")) != -1) {
+        switch (opt) {
+        case 'c':
+            lg.connections = atoi(optarg);
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 's':
+            lg.station = optarg;
+            break;
+        case 't':
+            tick = atoi(optarg);
+            break;
+        case 'S':
+            lg.slow = atof(optarg);
+            break;
+        case 'R':
+            lg.slow_rate = atof(optarg);
+            break;
+        case 'a':
+            lg.sources = atoi(optarg);
+            break;
+        case 'h':
+            host = optarg;
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (argc - optind != 1 || lg.connections < 1 || duration <= 0
+        || tick < 1 || lg.slow < 0 || lg.slow > 1 || lg.slow_rate < 1
+        || lg.sources < 1 || lg.sources > 65535
+        || (lg.station != NULL && strlen(lg.station) > 255))
+    {
+        fprintf(stderr, USAGE, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    lg.interval = (uint64_t) tick * 1000000;
+    lg.addr.sin_family = AF_INET;
+    lg.addr.sin_port = htons(atoi(argv[optind]));
+    if (inet_pton(AF_INET, host, &lg.addr.sin_addr) != 1) {
+        fprintf(stderr, "%s: bad host %s\n", argv[0], host);
+        exit(EXIT_FAILURE);
+    }
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    lg.conns = (struct conn *) calloc(lg.connections, sizeof(struct conn));
+    buf = (uint8_t *) malloc(READSIZE);
+    if (lg.conns == NULL || buf == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    lg.efd = epoll_create1(EPOLL_CLOEXEC);
+    if (lg.efd == -1) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+
+    start = last_refill = metrics_now();
+    end = start + (uint64_t) (duration * 1e9);
+
+    while ((now = metrics_now()) < end) {
+        while (lg.opened < lg.connections
+               && (rate <= 0 || lg.opened < (now - start) / 1e9 * rate))
+        {
+            status = conn_open(&lg, &lg.conns[lg.opened], lg.opened, now);
+            if (status == -1) exit(EXIT_FAILURE);
+            lg.opened++;
+        }
+
+        if (now - last_refill >= REFILL) {
+            status = refill(&lg, (now - last_refill) / 1e9);
+            if (status == -1) exit(EXIT_FAILURE);
+            last_refill = now;
+        }
+
+        n = epoll_wait(lg.efd, events, MAXEVENTS, REFILL / 1000000);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+
+        now = metrics_now();
+        for (i = 0; i < n; i++) {
+            conn = (struct conn *) events[i].data.ptr;
+            if (conn->closed) continue;
+
+            if (!conn->connected)
+                status = conn_connected(&lg, conn);
+            else
+                status = conn_read(&lg, conn, buf, now);
+            if (status == -1) exit(EXIT_FAILURE);
+        }
+    }
+
+    report(&lg, (now - start) / 1e9);
+
+    for (i = 0; i < lg.opened; i++)
+        if (!lg.conns[i].closed) close(lg.conns[i].fd);
+
+    close(lg.efd);
+    free(lg.conns);
+    free(buf);
+
+    return lg.framing_errors > 0 || lg.order_errors > 0
+        ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,205 @@
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "rip.h"
+#include "ripx.h"
+
+static int write_all(int fd, const char *buf, size_t len) {
+    ssize_t count;
+
+    while (len > 0) {
+        count = write(fd, buf, len);
+        if (count == -1) {
+            if (errno == EINTR) continue;
+            perror("write");
+            return -1;
+        }
+
+        buf += count;
+        len -= count;
+    }
+
+    return 0;
+}
+
+static int write_padding(int fd, uint64_t *offset) {
+    static const char zeros[RIPXALIGN];
+    size_t len = (RIPXALIGN - *offset % RIPXALIGN) % RIPXALIGN;
+
+    *offset += len;
+    return write_all(fd, zeros, len);
+}
+
+static int pack(const char *out, char **inputs, int n) {
+    struct rip_map **maps;
+    struct ripx_entry *entries;
+    char *head, *tmp;
+    uint64_t offset;
+    size_t head_len, len;
+    int i, fd = -1, status = -1;
+
+    maps = (struct rip_map **) calloc(n, sizeof(struct rip_map *));
+    entries = (struct ripx_entry *) calloc(n, sizeof(struct ripx_entry));
+    tmp = (char *) malloc(strlen(out) + 5);
+    if (maps == NULL || entries == NULL || tmp == NULL) {
+        perror("calloc");
+        goto done;
+    }
+
+    sprintf(tmp, "%s.tmp", out);
+
+    head_len = RIPXHEADERSIZE + (size_t) n * RIPXENTRYSIZE;
+    offset = head_len;
+
+    for (i = 0; i < n; i++) {
+        maps[i] = rip_map_open(inputs[i]);
+        if (maps[i] == NULL) {
+            fprintf(stderr, "ripx: cannot read %s\n", inputs[i]);
+            goto done;
+        }
+
+        entries[i].metadata_offset = offset;
+        entries[i].metadata_len = rip_metadata_size(&maps[i]->metadata);
+        offset += entries[i].metadata_len;
+
+        if (offset > UINT32_MAX) {
+            fprintf(stderr, "ripx: metadata section too large\n");
+            goto done;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        offset += (RIPXALIGN - offset % RIPXALIGN) % RIPXALIGN;
+        entries[i].data_offset = offset;
+        entries[i].data_len = maps[i]->metadata.size;
+        offset += entries[i].data_len;
+    }
+
+    head = (char *) malloc(entries[n - 1].metadata_offset
+                           + entries[n - 1].metadata_len);
+    if (head == NULL) {
+        perror("malloc");
+        goto done;
+    }
+
+    ripx_encode_header(head, n);
+    for (i = 0; i < n; i++) {
+        ripx_encode_entry(head + RIPXHEADERSIZE + i * RIPXENTRYSIZE,
+                          &entries[i]);
+        rip_encode_metadata(&maps[i]->metadata,
+                            head + entries[i].metadata_offset);
+    }
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("open");
+        free(head);
+        goto done;
+    }
+
+    offset = entries[n - 1].metadata_offset + entries[n - 1].metadata_len;
+    if (write_all(fd, head, offset) == -1) {
+        free(head);
+        goto done;
+    }
+    free(head);
+
+    for (i = 0; i < n; i++) {
+        if (write_padding(fd, &offset) == -1) goto done;
+
+        len = entries[i].data_len;
+        if (write_all(fd, maps[i]->metadata.data, len) == -1) goto done;
+        offset += len;
+    }
+
+    if (close(fd) == -1) {
+        fd = -1;
+        perror("close");
+        goto done;
+    }
+    fd = -1;
+
+    if (rename(tmp, out) == -1) {
+        perror("rename");
+        goto done;
+    }
+
+    printf("packed %d tracks into %s (%llu bytes)\n", n, out,
+           (unsigned long long) offset);
+    status = 0;
+
+done:
+    if (fd != -1) {
+        close(fd);
+        unlink(tmp);
+    }
+
+    if (maps != NULL)
+        for (i = 0; i < n; i++) rip_map_unref(maps[i]);
+
+    free(maps);
+    free(entries);
+    free(tmp);
+    return status;
+}
+
+static int check(const char *path) {
+    struct ripx_entry entry;
+    struct rip_map *map;
+    struct ripx ripx;
+    uint32_t i;
+
+    if (ripx_open(&ripx, path) == -1) {
+        ripx_free(&ripx);
+        return -1;
+    }
+
+    for (i = 0; i < ripx.count; i++) {
+        ripx_entry(&ripx, i, &entry);
+
+        map = ripx_track(&ripx, i);
+        if (map == NULL) {
+            ripx_free(&ripx);
+            return -1;
+        }
+
+        printf("%u: ", i);
+        rip_print_metadata(&map->metadata);
+        printf(" @%llu+%u\n", (unsigned long long) entry.data_offset,
+               entry.data_len);
+
+        rip_map_unref(map);
+    }
+
+    printf("%s: %u tracks ok\n", path, ripx.count);
+
+    ripx_free(&ripx);
+    return 0;
+}
+
+const char* const USAGE =
+    "usage: %s pack <archive.ripx> <track.rip>...\n"
+    "       %s check <archive.ripx>\n";
+
+int main(int argc, char *argv[]) {
+    int status;
+
+    if (argc >= 4 && strcmp(argv[1], "pack") == 0) {
+        status = pack(argv[2], argv + 3, argc - 3);
+    } else if (argc == 3 && strcmp(argv[1], "check") == 0) {
+        status = check(argv[2]);
+    } else {
+        fprintf(stderr, USAGE, argv[0], argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    return status == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
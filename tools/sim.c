@@ -0,0 +1,809 @@
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "rip.h"
+#include "log.h"
+#include "packet.h"
+#include "shard.h"
+#include "metrics.h"
+
+#define SIMFD 1000000
+#define SETTLE 16
+#define WINDOW 65536
+
+enum state {
+    EXPECT_TYPE,
+    META_TOTAL,
+    META_LEN,
+    META_STR,
+    DATA_HEAD,
+    DATA_BODY
+};
+
+struct peer {
+    uint64_t data;
+    uint32_t events;
+    unsigned int registered: 1;
+    unsigned int hello: 1;
+    unsigned int open: 1;
+    unsigned int hung_up: 1;
+    unsigned int hup_sent: 1;
+    unsigned int wants_out: 1;
+    unsigned int slow: 1;
+    unsigned int broken: 1;
+    unsigned int has_meta: 1;
+    unsigned int has_seq: 1;
+
+    int live;
+    uint64_t joined;
+    uint64_t stall_at;
+    uint64_t buffered;
+
+    enum state state;
+    uint8_t field[8];
+    unsigned int field_len;
+    unsigned int field_need;
+    unsigned int strings;
+    uint32_t skip;
+    uint32_t data_len;
+    uint32_t time;
+    uint8_t payload[8];
+    unsigned int payload_len;
+    char name[32];
+    unsigned int name_len;
+
+    uint64_t track;
+    uint64_t last_seq;
+};
+
+struct sim {
+    struct shard *shard;
+    int clients;
+    uint64_t ticks;
+    uint64_t interval;
+    uint64_t track_ticks;
+    uint32_t frame;
+    enum policy policy;
+    double slow;
+    uint64_t slow_rate;
+    uint64_t slow_drain;
+    double stall;
+    double eagain;
+    double partial;
+    double churn;
+    uint64_t window;
+    uint64_t seed;
+
+    uint64_t now;
+    uint64_t seq;
+    struct peer *peers;
+    int peers_len;
+    int peers_cap;
+    int *live;
+    int pending;
+    int open;
+
+    uint64_t bytes;
+    uint64_t packets;
+    uint64_t metadata;
+    uint64_t injected_eagain;
+    uint64_t injected_partial;
+    uint64_t skipped;
+    uint64_t closed_slow;
+    uint64_t closed_fast;
+    uint64_t hung_up;
+    uint64_t framing_errors;
+    uint64_t time_errors;
+    uint64_t order_errors;
+    uint64_t gap_errors;
+    uint64_t metadata_errors;
+    uint64_t behind_errors;
+};
+
+static struct sim sim;
+
+const char* const USAGE =
+    "usage: %s [-c clients] [-d duration s] [-t tick ms] [-T track s] "
+    "[-P drop|skip|shrink] [-L lag ticks] [-B burst ticks] "
+    "[-S slow fraction] [-R slow bytes per s] [-X stall fraction] "
+    "[-e eagain probability] [-p partial probability] "
+    "[-C churn per client per s] [-w window bytes] [-s seed]\n";
+
+static uint64_t sim_next(void) {
+    sim.seed ^= sim.seed >> 12;
+    sim.seed ^= sim.seed << 25;
+    sim.seed ^= sim.seed >> 27;
+    return sim.seed * 0x2545f4914f6cdd1dULL;
+}
+
+static double sim_random(void) {
+    return (sim_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint32_t read_u32(const uint8_t *buf) {
+    return (uint32_t) buf[0] << 24 | (uint32_t) buf[1] << 16
+        | (uint32_t) buf[2] << 8 | buf[3];
+}
+
+static struct peer *sim_peer(int fd) {
+    if (fd < SIMFD || fd - SIMFD >= sim.peers_len) return NULL;
+    return &sim.peers[fd - SIMFD];
+}
+
+static void peer_data(struct peer *peer) {
+    uint64_t seq = 0;
+    int i;
+
+    sim.packets++;
+
+    if (peer->data_len != sim.frame || peer->payload_len < 8) {
+        sim.framing_errors++;
+        peer->broken = 1;
+        return;
+    }
+
+    for (i = 0; i < 8; i++)
+        seq = seq << 8 | peer->payload[i];
+
+    if (!peer->has_meta || seq / sim.track_ticks != peer->track)
+        sim.metadata_errors++;
+
+    if (peer->time != BYTES_TO_CS(seq % sim.track_ticks * sim.frame))
+        sim.time_errors++;
+
+    if (peer->has_seq) {
+        if (seq <= peer->last_seq)
+            sim.order_errors++;
+        else if (seq != peer->last_seq + 1 && sim.policy == POLICY_DROP)
+            sim.gap_errors++;
+        else
+            sim.skipped += seq - peer->last_seq - 1;
+    }
+
+    peer->last_seq = seq;
+    peer->has_seq = 1;
+}
+
+static void peer_metadata(struct peer *peer) {
+    unsigned long long track;
+
+    sim.metadata++;
+    peer->name[peer->name_len] = '\0';
+
+    if (sscanf(peer->name, "Track %llu", &track) != 1) {
+        sim.framing_errors++;
+        peer->broken = 1;
+        return;
+    }
+
+    peer->track = track;
+    peer->has_meta = 1;
+}
+
+static void peer_parse(struct peer *peer, const uint8_t *buf, size_t len) {
+    size_t n;
+
+    while (!peer->broken
+           && (len > 0 || (peer->skip == 0
+                           && (peer->state == META_STR
+                               || peer->state == DATA_BODY))))
+    {
+        switch (peer->state) {
+        case EXPECT_TYPE:
+            peer->field_len = 0;
+            if (buf[0] == 1) {
+                peer->state = META_TOTAL;
+                peer->field_need = 4;
+                peer->strings = 0;
+            } else if (buf[0] == 2) {
+                peer->state = DATA_HEAD;
+                peer->field_need = 8;
+            } else {
+                sim.framing_errors++;
+                peer->broken = 1;
+                return;
+            }
+            buf++;
+            len--;
+            break;
+
+        case META_TOTAL:
+        case META_LEN:
+        case DATA_HEAD:
+            n = peer->field_need - peer->field_len;
+            if (n > len) n = len;
+            memcpy(peer->field + peer->field_len, buf, n);
+            peer->field_len += n;
+            buf += n;
+            len -= n;
+
+            if (peer->field_len < peer->field_need) break;
+            peer->field_len = 0;
+
+            if (peer->state == META_TOTAL) {
+                peer->state = META_LEN;
+                peer->field_need = 2;
+            } else if (peer->state == META_LEN) {
+                peer->skip = (uint32_t) peer->field[0] << 8 | peer->field[1];
+                peer->name_len = 0;
+                peer->state = META_STR;
+            } else {
+                peer->skip = peer->data_len = read_u32(peer->field);
+                peer->time = read_u32(peer->field + 4);
+                peer->payload_len = 0;
+                peer->state = DATA_BODY;
+            }
+            break;
+
+        case META_STR:
+        case DATA_BODY:
+            n = peer->skip < len ? peer->skip : len;
+
+            if (peer->state == DATA_BODY && peer->payload_len < 8) {
+                size_t copy = 8 - peer->payload_len;
+                if (copy > n) copy = n;
+                memcpy(peer->payload + peer->payload_len, buf, copy);
+                peer->payload_len += copy;
+            } else if (peer->state == META_STR && peer->strings == 0) {
+                size_t copy = sizeof peer->name - 1 - peer->name_len;
+                if (copy > n) copy = n;
+                memcpy(peer->name + peer->name_len, buf, copy);
+                peer->name_len += copy;
+            }
+
+            peer->skip -= n;
+            buf += n;
+            len -= n;
+
+            if (peer->skip > 0) break;
+
+            if (peer->state == DATA_BODY) {
+                peer_data(peer);
+                peer->state = EXPECT_TYPE;
+            } else if (++peer->strings == 3) {
+                peer->state = EXPECT_TYPE;
+            } else {
+                if (peer->strings == 1) peer_metadata(peer);
+                peer->state = META_LEN;
+                peer->field_need = 2;
+            }
+            break;
+        }
+    }
+}
+
+static int sim_accept4(int fd __attribute__((unused)), struct sockaddr *addr,
+                       socklen_t *len, int flags __attribute__((unused)))
+{
+    struct sockaddr_in *in = (struct sockaddr_in *) addr;
+    struct peer *peer;
+    int index;
+
+    if (sim.pending == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    if (sim.peers_len == sim.peers_cap) {
+        sim.peers_cap = sim.peers_cap == 0 ? 1024 : sim.peers_cap * 2;
+        sim.peers = (struct peer *) realloc(sim.peers, sim.peers_cap
+                                            * sizeof(struct peer));
+        sim.live = (int *) realloc(sim.live, sim.peers_cap * sizeof(int));
+        if (sim.peers == NULL || sim.live == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    index = sim.peers_len++;
+    sim.pending--;
+
+    peer = &sim.peers[index];
+    memset(peer, 0, sizeof *peer);
+    peer->live = sim.open;
+    sim.live[sim.open++] = index;
+    peer->open = 1;
+    peer->hello = 1;
+    peer->joined = sim.seq;
+    peer->slow = sim_random() < sim.slow;
+    if (sim_random() < sim.stall)
+        peer->stall_at = sim.seq + 1 + sim_next() % sim.ticks;
+
+    memset(in, 0, sizeof *in);
+    in->sin_family = AF_INET;
+    in->sin_port = htons(1024 + index % 60000);
+    in->sin_addr.s_addr = htonl(0x0a000000u + index % 0xffffff);
+    *len = sizeof *in;
+
+    return SIMFD + index;
+}
+
+static ssize_t sim_recv(int fd, void *buf, size_t len,
+                        int flags __attribute__((unused)))
+{
+    struct peer *peer = sim_peer(fd);
+
+    if (peer == NULL || !peer->hello || len == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    peer->hello = 0;
+    ((char *) buf)[0] = '\0';
+    return 1;
+}
+
+static ssize_t sim_recvmsg(int fd __attribute__((unused)),
+                           struct msghdr *msg __attribute__((unused)),
+                           int flags __attribute__((unused)))
+{
+    errno = EAGAIN;
+    return -1;
+}
+
+static ssize_t sim_sendmsg(int fd, const struct msghdr *msg,
+                           int flags __attribute__((unused)))
+{
+    struct peer *peer = sim_peer(fd);
+    size_t total = 0, count, n, i;
+
+    if (peer == NULL || !peer->open || peer->hung_up) {
+        errno = EPIPE;
+        return -1;
+    }
+
+    for (i = 0; i < msg->msg_iovlen; i++)
+        total += msg->msg_iov[i].iov_len;
+
+    if (peer->buffered >= sim.window || sim_random() < sim.eagain) {
+        if (peer->buffered < sim.window) sim.injected_eagain++;
+        peer->wants_out = 1;
+        errno = EAGAIN;
+        return -1;
+    }
+
+    count = sim.window - peer->buffered;
+    if (count > total) count = total;
+
+    if (count > 1 && sim_random() < sim.partial) {
+        count = 1 + sim_next() % (count - 1);
+        sim.injected_partial++;
+    }
+
+    if (count < total) peer->wants_out = 1;
+
+    for (i = 0, n = count; n > 0; i++) {
+        size_t len = msg->msg_iov[i].iov_len < n
+            ? msg->msg_iov[i].iov_len : n;
+
+        peer_parse(peer, (const uint8_t *) msg->msg_iov[i].iov_base, len);
+        n -= len;
+    }
+
+    peer->buffered += count;
+    sim.bytes += count;
+    return count;
+}
+
+static int sim_setsockopt(int fd __attribute__((unused)),
+                          int level __attribute__((unused)),
+                          int name __attribute__((unused)),
+                          const void *value __attribute__((unused)),
+                          socklen_t len __attribute__((unused)))
+{
+    return 0;
+}
+
+static int sim_shutdown(int fd, int how __attribute__((unused))) {
+    struct peer *peer = sim_peer(fd);
+
+    if (peer == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int sim_close(int fd) {
+    struct peer *peer = sim_peer(fd);
+
+    if (peer == NULL || !peer->open) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (!peer->hung_up) {
+        if (peer->slow || peer->stall_at != 0) sim.closed_slow++;
+        else sim.closed_fast++;
+    }
+
+    peer->open = 0;
+    peer->registered = 0;
+
+    sim.live[peer->live] = sim.live[--sim.open];
+    sim.peers[sim.live[peer->live]].live = peer->live;
+    return 0;
+}
+
+static int sim_epoll_ctl(int efd __attribute__((unused)), int op, int fd,
+                         struct epoll_event *event)
+{
+    struct peer *peer = sim_peer(fd);
+
+    if (peer == NULL || !peer->open) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (op == EPOLL_CTL_DEL) {
+        peer->registered = 0;
+        return 0;
+    }
+
+    peer->data = event->data.u64;
+    peer->events = event->events;
+    peer->registered = 1;
+    if (event->events & EPOLLOUT) peer->wants_out = 1;
+
+    return 0;
+}
+
+static uint64_t sim_clock(void) {
+    return sim.now;
+}
+
+static const struct shard_io sim_io = {
+    sim_accept4, sim_recv, sim_recvmsg, sim_sendmsg, sim_setsockopt,
+    sim_shutdown, sim_close, sim_epoll_ctl, sim_clock
+};
+
+static int sim_dispatch(struct peer *peer, uint32_t events) {
+    if (peer->events & EPOLLONESHOT) peer->events = 0;
+    return shard_dispatch(sim.shard, peer->data, events);
+}
+
+static int sim_publish(struct shard *shard) {
+    struct rip_metadata metadata;
+    struct packet *packet;
+    char name[32];
+    int i, status;
+
+    if (sim.seq % sim.track_ticks == 0) {
+        memset(&metadata, 0, sizeof metadata);
+        snprintf(name, sizeof name, "Track %llu",
+                 (unsigned long long) (sim.seq / sim.track_ticks));
+        metadata.name.data = name;
+        metadata.name.len = strlen(name);
+        metadata.artist.data = metadata.album.data = "sim";
+        metadata.artist.len = metadata.album.len = 3;
+        metadata.length = BYTES_TO_CS(sim.track_ticks * sim.frame);
+
+        packet = packet_new(rip_metadata_size(&metadata));
+        if (packet == NULL) return -1;
+        rip_encode_metadata(&metadata, packet->data);
+
+        status = shard_publish(shard, 0, packet);
+        packet_unref(packet);
+        if (status == -1) return -1;
+    }
+
+    packet = packet_new(HEADERSIZE + sim.frame);
+    if (packet == NULL) return -1;
+
+    rip_encode_header(packet->data, sim.frame,
+                      sim.seq % sim.track_ticks * sim.frame);
+    memset(packet->data + HEADERSIZE, 0, sim.frame);
+    for (i = 0; i < 8; i++)
+        packet->data[HEADERSIZE + i] = sim.seq >> (56 - 8 * i);
+
+    status = shard_publish(shard, 0, packet);
+    packet_unref(packet);
+    if (status == -1) return -1;
+
+    status = shard_notify(shard);
+    if (status == -1) return -1;
+
+    return shard->inbox_event.handler(&shard->inbox_event, EPOLLIN);
+}
+
+static int sim_connect(struct shard *shard) {
+    struct peer *peer;
+    int i, status;
+
+    sim.pending = sim.clients - sim.open;
+    if (sim.pending <= 0) {
+        sim.pending = 0;
+        return 0;
+    }
+
+    i = sim.peers_len;
+    do {
+        status = shard->listener.handler(&shard->listener, EPOLLIN);
+        if (status == -1) return -1;
+    } while (shard->accept_pending);
+
+    for (; i < sim.peers_len; i++) {
+        peer = &sim.peers[i];
+        if (!peer->registered || !(peer->events & EPOLLIN)) continue;
+
+        status = sim_dispatch(peer, EPOLLIN);
+        if (status == -1) return -1;
+    }
+
+    return 0;
+}
+
+static int sim_drain(uint64_t tick, int churn) {
+    uint64_t drained;
+    struct peer *peer;
+    int i, status;
+
+    for (i = 0; i < sim.open; i++) {
+        peer = &sim.peers[sim.live[i]];
+
+        if (churn && !peer->hung_up && sim_random() < sim.churn) {
+            peer->hung_up = 1;
+            sim.hung_up++;
+        }
+
+        if (peer->hung_up) {
+            if (peer->hup_sent || !peer->registered) continue;
+            peer->hup_sent = 1;
+
+            status = sim_dispatch(peer, EPOLLHUP | EPOLLERR);
+            if (status == -1) return -1;
+            if (!peer->open) i--;
+            continue;
+        }
+
+        if (peer->stall_at == 0 || tick < peer->stall_at) {
+            drained = peer->buffered;
+            if (peer->slow && drained > sim.slow_drain)
+                drained = sim.slow_drain;
+            peer->buffered -= drained;
+        }
+
+        if (!peer->wants_out || !peer->registered
+            || !(peer->events & EPOLLOUT) || peer->buffered >= sim.window)
+            continue;
+
+        peer->wants_out = 0;
+        status = sim_dispatch(peer, EPOLLOUT);
+        if (status == -1) return -1;
+        if (!peer->open) i--;
+    }
+
+    return 0;
+}
+
+static int sim_check(void) {
+    struct peer *peer;
+    int i, caught_up = 0;
+
+    for (i = 0; i < sim.open; i++) {
+        peer = &sim.peers[sim.live[i]];
+        if (peer->slow || peer->stall_at != 0 || peer->broken)
+            continue;
+
+        if (peer->joined < sim.seq
+            && (!peer->has_seq || peer->last_seq + 1 != sim.seq))
+            sim.behind_errors++;
+        else
+            caught_up++;
+    }
+
+    return caught_up;
+}
+
+static void report(double wall, int caught_up) {
+    double simulated = (double) sim.ticks * sim.interval / 1e9;
+
+    printf("simulated %.0f s in %.3f s (%.0fx)\n", simulated, wall,
+           simulated / wall);
+    printf("connections %d open %d caught up %d hung up %llu\n",
+           sim.peers_len, sim.open, caught_up,
+           (unsigned long long) sim.hung_up);
+    printf("closed slow %llu fast %llu\n",
+           (unsigned long long) sim.closed_slow,
+           (unsigned long long) sim.closed_fast);
+    printf("bytes %llu packets %llu metadata %llu skipped %llu\n",
+           (unsigned long long) sim.bytes, (unsigned long long) sim.packets,
+           (unsigned long long) sim.metadata,
+           (unsigned long long) sim.skipped);
+    printf("injected eagain %llu partial %llu\n",
+           (unsigned long long) sim.injected_eagain,
+           (unsigned long long) sim.injected_partial);
+    printf("errors framing %llu time %llu order %llu gap %llu metadata %llu "
+           "behind %llu\n",
+           (unsigned long long) sim.framing_errors,
+           (unsigned long long) sim.time_errors,
+           (unsigned long long) sim.order_errors,
+           (unsigned long long) sim.gap_errors,
+           (unsigned long long) sim.metadata_errors,
+           (unsigned long long) sim.behind_errors);
+}
+
+static int parse_policy(const char *name, enum policy *policy) {
+    if (strcmp(name, "drop") == 0) *policy = POLICY_DROP;
+    else if (strcmp(name, "skip") == 0) *policy = POLICY_SKIP;
+    else if (strcmp(name, "shrink") == 0) *policy = POLICY_SHRINK;
+    else return -1;
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    struct shard_config config;
+    struct shard shard;
+    const char *feeds[] = {"sim"};
+    double duration = 3600, track = 180;
+    uint64_t tick, start, ticks_per_second;
+    int opt, sfd, status, caught_up, interval = 250;
+    int lag = MAXLAG, burst = 0;
+
+    memset(&sim, 0, sizeof sim);
+    sim.clients = 1000;
+    sim.slow = 0.05;
+    sim.slow_rate = BYTERATE * 2 / 3;
+    sim.stall = 0.01;
+    sim.eagain = 0.05;
+    sim.partial = 0.1;
+    sim.churn = 0.001;
+    sim.window = WINDOW;
+    sim.seed = 1;
+
+    while ((opt = getopt(argc, argv, "c:d:t:T:P:L:B:S:R:X:e:p:C:w:s:"))
+           != -1)
+    {
+        switch (opt) {
+        case 'c':
+            sim.clients = atoi(optarg);
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        case 't':
+            interval = atoi(optarg);
+            break;
+        case 'T':
+            track = atof(optarg);
+            break;
+        case 'P':
+            if (parse_policy(optarg, &sim.policy) == -1) {
+                fprintf(stderr, USAGE, argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'L':
+            lag = atoi(optarg);
+            break;
+        case 'B':
+            burst = atoi(optarg);
+            break;
+        case 'S':
+            sim.slow = atof(optarg);
+            break;
+        case 'R':
+            sim.slow_rate = strtoull(optarg, NULL, 10);
+            break;
+        case 'X':
+            sim.stall = atof(optarg);
+            break;
+        case 'e':
+            sim.eagain = atof(optarg);
+            break;
+        case 'p':
+            sim.partial = atof(optarg);
+            break;
+        case 'C':
+            sim.churn = atof(optarg);
+            break;
+        case 'w':
+            sim.window = strtoull(optarg, NULL, 10);
+            break;
+        case 's':
+            sim.seed = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (argc != optind || sim.clients < 1 || duration <= 0 || interval < 1
+        || 1000 % interval != 0 || track * 1000 < interval
+        || lag < 2 || lag >= RINGSIZE || burst < 0 || burst > lag / 2
+        || sim.slow < 0 || sim.slow > 1 || sim.stall < 0 || sim.stall > 1
+        || sim.eagain < 0 || sim.eagain >= 1 || sim.partial < 0
+        || sim.partial > 1 || sim.churn < 0 || sim.churn > 1
+        || sim.window < 1 || sim.seed == 0)
+    {
+        fprintf(stderr, USAGE, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    sim.interval = (uint64_t) interval * 1000000;
+    sim.frame = (uint64_t) interval * BYTERATE / 1000;
+    sim.ticks = (uint64_t) (duration * 1000 / interval);
+    sim.track_ticks = (uint64_t) (track * 1000 / interval);
+    sim.slow_drain = sim.slow_rate * interval / 1000;
+    sim.churn /= 1000 / interval;
+    ticks_per_second = 1000 / interval;
+
+    memset(&config, 0, sizeof config);
+    config.backend = BACKEND_EPOLL;
+    config.policy = sim.policy;
+    config.burst = burst;
+    config.lag = lag;
+    config.per_ip = MAXPERIP;
+    config.io = &sim_io;
+    config.ip_counts = (uint32_t *) calloc(IPSLOTS, sizeof(uint32_t));
+    if (config.ip_counts == NULL) exit(EXIT_FAILURE);
+
+    if (log_start(LOG_ERROR) == -1) exit(EXIT_FAILURE);
+    log_attach("sim");
+
+    sfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sfd == -1) {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    status = shard_new(&shard, 0, sfd, &config, feeds, 1);
+    if (status == -1) exit(EXIT_FAILURE);
+
+    sim.shard = &shard;
+    start = metrics_now();
+
+    for (tick = 1; tick <= sim.ticks; tick++) {
+        sim.now = tick * sim.interval;
+
+        status = sim_publish(&shard);
+        if (status == -1) exit(EXIT_FAILURE);
+        sim.seq++;
+
+        status = sim_connect(&shard);
+        if (status == -1) exit(EXIT_FAILURE);
+
+        status = sim_drain(tick, 1);
+        if (status == -1) exit(EXIT_FAILURE);
+
+        if (tick % ticks_per_second == 0) {
+            status = shard_advance(&shard, 1);
+            if (status == -1) exit(EXIT_FAILURE);
+        }
+    }
+
+    for (tick = 0; tick < SETTLE; tick++) {
+        status = sim_drain(sim.ticks, 0);
+        if (status == -1) exit(EXIT_FAILURE);
+    }
+
+    caught_up = sim_check();
+    report((metrics_now() - start) / 1e9, caught_up);
+
+    status = sim.framing_errors > 0 || sim.time_errors > 0
+        || sim.order_errors > 0 || sim.gap_errors > 0
+        || sim.metadata_errors > 0 || sim.behind_errors > 0
+        || sim.closed_fast > 0;
+
+    shard_free(&shard);
+    log_stop();
+    free(config.ip_counts);
+    free(sim.peers);
+    free(sim.live);
+
+    return status ? EXIT_FAILURE : EXIT_SUCCESS;
+}